@@ -0,0 +1,488 @@
+"""Parse and render the disassembly of compiled objects"""
+from __future__ import annotations
+
+import difflib
+import os
+import re
+from html import escape
+from typing import Callable, Dict, List, NamedTuple, Optional, Sequence, Tuple
+
+from .report import MimeBundle
+
+# Matches a function header, e.g. "0000000000000000 <dot(float*, int)>:"
+_function = re.compile(r"^[0-9a-f]+ <(.+)>:$")
+
+# Matches an instruction, e.g. "  2d:	jne    18 <dot+0x18>"
+_instruction = re.compile(r"^\s*([0-9a-f]+):\t(\S+)\s*(.*)$")
+
+# Matches a relocation, e.g. "			15: R_X86_64_PLT32	printf-0x4"
+_relocation = re.compile(r"^\s*[0-9a-f]+: (R_\S+)\s+(\S+)")
+
+# Matches a source location, e.g. "/tmp/w/dot.c:5 (discriminator 3)"
+_location = re.compile(r"^(\S+):(\d+)(?: \(discriminator \d+\))?$")
+
+# Matches the target of a direct branch, e.g. "18 <dot+0x18>"
+_branch_target = re.compile(r"^([0-9a-f]+) <([^>]+?)(?:\+0x[0-9a-f]+)?>")
+
+# Mnemonics (or their prefixes) which call rather than branch
+_calls = ("call", "bl", "blr")
+
+# Prefixes which objdump shows in place of the mnemonic, e.g. "bnd jmp"
+_prefixes = ("bnd", "notrack", "rep", "repz", "repe")
+
+# SIMD registers and their widths in bits: x86 xmm/ymm/zmm, AArch64 NEON
+# (v0.4s etc.) and SVE (z0.s etc., whose width depends on the CPU)
+_vector_registers = [
+    (re.compile(r"%?zmm\d+"), 512),
+    (re.compile(r"%?ymm\d+"), 256),
+    (re.compile(r"%?xmm\d+"), 128),
+    (re.compile(r"\bv\d+\.\d*[bhsd]\b"), 128),
+    (re.compile(r"\bz\d+\.[bhsdq]\b"), 128),
+]
+
+
+# Matches a label in compiler-generated assembly, e.g. ".L9:" or "saxpy:"
+_asm_label = re.compile(r"^([\w.$]+):")
+
+# Matches a source location directive, e.g. "	.loc 1 5 19 is_stmt 0"
+_asm_loc = re.compile(r"^\s*\.loc\s+(\d+)\s+(\d+)")
+
+# Matches a source file directive, e.g. '	.file 1 "dot.c"'
+_asm_file = re.compile(r'^\s*\.file\s+(\d+)\s+(?:"[^"]*"\s+)?"([^"]+)"')
+
+# Matches a function type directive, e.g. "	.type	saxpy, @function"
+_asm_function = re.compile(r"^\s*\.type\s+([\w.$]+),\s*[@%]function")
+
+# Mnemonics of conditional and unconditional AArch64 branches to a label
+_arm_branches = ("b", "cbz", "cbnz", "tbz", "tbnz")
+
+# Matches a comment marking a region of the cell for llvm-mca, e.g.
+# "// ckernel:mca-begin inner loop"
+_mca_marker = re.compile(r"//\s*ckernel:mca-(begin|end)\b\s*(.*)$")
+
+
+class Instruction(NamedTuple):
+    """One disassembled instruction. target is the address it branches to
+    within the same function and line the source line it came from, if
+    known."""
+
+    address: int
+    mnemonic: str
+    operands: str
+    target: Optional[int]
+    line: Optional[int]
+    relocation: str = ""
+
+
+class Function(NamedTuple):
+    name: str
+    instructions: List[Instruction]
+
+
+def objdump_command(obj: str) -> str:
+    "Return the command which disassembles obj in the form parse_objdump expects"
+    return f"objdump -d -l -C -r --no-show-raw-insn {obj}"
+
+
+def parse_objdump(lines: Sequence[str], source: str) -> List[Function]:
+    """Parse the output of objdump_command into functions. Only source lines
+    from the file named source are recorded."""
+    functions: List[Function] = []
+    source_name = os.path.basename(source)
+    line: Optional[int] = None
+    for text in lines:
+        text = text.rstrip("\n")
+        if match := _function.match(text):
+            functions.append(Function(match.group(1), []))
+            line = None
+        elif not functions:
+            continue
+        elif match := _relocation.match(text):
+            instructions = functions[-1].instructions
+            if instructions:
+                instructions[-1] = instructions[-1]._replace(
+                    relocation=match.group(2)
+                )
+        elif match := _instruction.match(text):
+            address, mnemonic, operands = match.groups()
+            operands = operands.strip()
+            target = None
+            branch = _branch_target.match(operands)
+            if branch and not mnemonic.startswith(_calls):
+                name = functions[-1].name
+                if branch.group(2) == name.split("(")[0] or branch.group(2) == name:
+                    target = int(branch.group(1), 16)
+            functions[-1].instructions.append(
+                Instruction(int(address, 16), mnemonic, operands, target, line)
+            )
+        elif match := _location.match(text.strip()):
+            path, number = match.groups()
+            line = int(number) if os.path.basename(path) == source_name else None
+    return functions
+
+
+def matches(name: str, wanted: str) -> bool:
+    """Whether the (demangled) function name is the one wanted, ignoring
+    parameter lists and including compiler-generated clones like foo.cold"""
+    base = name.split("(")[0]
+    return wanted in (name, base) or base.startswith(wanted + ".")
+
+
+def control_flow(mnemonic: str, operands: str) -> str:
+    """Return how an instruction transfers control: "branch" or "jump" for a
+    conditional or unconditional direct branch, "leave" for a return, call or
+    indirect branch, or "" if it doesn't"""
+    if mnemonic in _prefixes and operands:
+        mnemonic, *rest = operands.split(None, 1)
+        operands = rest[0] if rest else ""
+    base = mnemonic.split(".")[0]
+    if base.startswith(("ret", "call")) or base in ("br", "bl", "blr"):
+        return "leave"
+    if mnemonic.startswith("j"):
+        if "*" in operands:
+            return "leave"
+        return "jump" if mnemonic in ("jmp", "jmpq") else "branch"
+    if base in _arm_branches:
+        return "jump" if mnemonic == "b" else "branch"
+    return ""
+
+
+def latches(flows: Sequence[Tuple[str, Optional[int]]]) -> Dict[int, int]:
+    """Return the index of each loop latch among a function's instructions,
+    with the index of the loop's header, given the control_flow of each
+    instruction and the index of the instruction it branches to (None if it
+    is outside the function). A latch is a conditional branch back to a
+    header which dominates it: the loop may only be entered through its
+    header, and contains no return, call or branch out of the loop."""
+    found = {}
+    for end, (kind, head) in enumerate(flows):
+        if kind != "branch" or head is None or head > end:
+            continue
+        inside = range(head, end + 1)
+        leaves = any(
+            kind == "leave" or (kind and target not in inside)
+            for kind, target in flows[head:end]
+        )
+        enters = any(
+            kind and target is not None and head < target <= end
+            for k, (kind, target) in enumerate(flows)
+            if k not in inside
+        )
+        if not leaves and not enters:
+            found[end] = head
+    return found
+
+
+def back_edges(function: Function) -> Dict[int, int]:
+    "Return the address of each loop latch in function, with its loop's header"
+    instructions = function.instructions
+    index = {ins.address: k for k, ins in enumerate(instructions)}
+    flows = [
+        (control_flow(ins.mnemonic, ins.operands), index.get(ins.target))
+        for ins in instructions
+    ]
+    return {
+        instructions[end].address: instructions[head].address
+        for end, head in latches(flows).items()
+    }
+
+
+def vector_width(ins: Instruction) -> int:
+    """Return the width in bits of the SIMD registers a packed vector
+    instruction operates on, or 0 for other instructions (including scalar
+    floating-point instructions such as addss, which use xmm registers)"""
+    mnemonic = ins.mnemonic.split(".")[0]
+    if mnemonic.endswith(("ss", "sd")) or mnemonic.startswith(("cvtsi2", "vcvtsi2")):
+        return 0
+    return max(
+        (width for pattern, width in _vector_registers if pattern.search(ins.operands)),
+        default=0,
+    )
+
+
+def statistics(function: Function) -> Dict[str, int]:
+    "Return the instruction counts of a function"
+    widths = [vector_width(ins) for ins in function.instructions]
+    return {
+        "instructions": len(function.instructions),
+        "vector": sum(1 for width in widths if width),
+        "widest": max(widths, default=0),
+        "back_edges": len(back_edges(function)),
+    }
+
+
+def normalise(function: Function) -> List[str]:
+    """Return a function's instructions as text with branch targets replaced
+    by labels numbered in address order, so that listings of the same code at
+    different addresses compare equal"""
+    targets = sorted({ins.target for ins in function.instructions} - {None})
+    labels = {target: f".L{k}" for k, target in enumerate(targets)}
+    lines = []
+    for ins in function.instructions:
+        if ins.address in labels:
+            lines.append(f"{labels[ins.address]}:")
+        operands = ins.operands.split("#")[0].strip()
+        if ins.target is not None:
+            operands = labels[ins.target]
+        elif ins.relocation:
+            operands = f"{operands}  <{ins.relocation}>"
+        lines.append(f"    {ins.mnemonic} {operands}".rstrip())
+    return lines
+
+
+def diff(
+    before: Function, after: Function, labels: Sequence[str]
+) -> MimeBundle:
+    "Return a unified diff of the normalised listings of two functions"
+    lines = list(
+        difflib.unified_diff(
+            normalise(before),
+            normalise(after),
+            fromfile=f"{before.name} ({labels[0]})",
+            tofile=f"{after.name} ({labels[1]})",
+            lineterm="",
+        )
+    )
+    colours = {"+": "#55a868", "-": "#c44e52", "@": "#8172b3"}
+    html = ["<pre>"]
+    for line in lines:
+        colour = colours.get(line[:1])
+        if colour is None or line.startswith(("+++", "---")):
+            html.append(escape(line))
+        else:
+            html.append(f'<span style="color: {colour}">{escape(line)}</span>')
+    html.append("</pre>")
+    return {"text/plain": "\n".join(lines), "text/html": "\n".join(html)}
+
+
+class AsmLine(NamedTuple):
+    """An instruction from compiler-generated assembly (-S), with the source
+    line it came from (if in the cell) and its enclosing function"""
+
+    text: str
+    line: Optional[int]
+    function: str
+
+
+class Listing(NamedTuple):
+    instructions: List[AsmLine]
+    labels: Dict[str, int]  # the index of the instruction each label precedes
+
+
+def parse_listing(lines: Sequence[str], source: str) -> Listing:
+    """Parse the assembly written by compiling source with -S -g. Only source
+    lines from source itself are recorded."""
+    source_name = os.path.basename(source)
+    instructions: List[AsmLine] = []
+    labels: Dict[str, int] = {}
+    files: Dict[str, str] = {}
+    functions = set()
+    function, line = "", None
+    for text in lines:
+        text = text.rstrip()
+        if match := _asm_label.match(text):
+            labels[match.group(1)] = len(instructions)
+            if match.group(1) in functions:
+                function, line = match.group(1), None
+        elif match := _asm_file.match(text):
+            files[match.group(1)] = os.path.basename(match.group(2))
+        elif match := _asm_loc.match(text):
+            in_source = files.get(match.group(1)) == source_name
+            line = int(match.group(2)) if in_source else None
+        elif match := _asm_function.match(text):
+            functions.add(match.group(1))
+        elif text.strip() and not text.strip().startswith((".", "#", "//")):
+            instructions.append(AsmLine(text.strip(), line, function))
+    return Listing(instructions, labels)
+
+
+def loops(listing: Listing) -> List[Tuple[int, int]]:
+    """Return the innermost loops of a listing as the (inclusive) indices of
+    their header and their latch, see latches"""
+    flows = []
+    for ins in listing.instructions:
+        mnemonic, _, operands = ins.text.partition("\t")
+        kind = control_flow(mnemonic, operands.strip())
+        target = None
+        if kind in ("branch", "jump"):
+            target = listing.labels.get(operands.split(",")[-1].strip())
+            if target is not None and (
+                target >= len(listing.instructions)
+                or listing.instructions[target].function != ins.function
+            ):
+                target = None
+        flows.append((kind, target))
+    found = sorted((start, end) for end, start in latches(flows).items())
+    return [
+        (start, end)
+        for start, end in found
+        if not any(start <= s and e <= end and (s, e) != (start, end) for s, e in found)
+    ]
+
+
+def select_loops(
+    listing: Listing, wanted: Callable[[AsmLine], bool]
+) -> List[Tuple[int, int]]:
+    "Return the innermost loops in which most instructions are wanted"
+    selected = []
+    for start, end in loops(listing):
+        body = listing.instructions[start : end + 1]
+        if 2 * sum(1 for ins in body if wanted(ins)) > len(body):
+            selected.append((start, end))
+    return selected
+
+
+def marked_regions(source_lines: Sequence[str]) -> List[Tuple[str, int, int]]:
+    """Return the name, first and last line of each region of source marked
+    by "// ckernel:mca-begin [name]" and "// ckernel:mca-end" comments"""
+    regions = []
+    begin = None
+    for number, text in enumerate(source_lines, start=1):
+        match = _mca_marker.search(text)
+        if match is None:
+            continue
+        if match.group(1) == "begin":
+            begin = (match.group(2).strip(), number + 1)
+        elif begin is not None:
+            name, first = begin
+            regions.append((name or f"lines {first}-{number - 1}", first, number - 1))
+            begin = None
+    return regions
+
+
+def from_lines(first: int, last: int) -> Callable[[AsmLine], bool]:
+    "Return whether an instruction came from the given source lines"
+    return lambda ins: ins.line is not None and first <= ins.line <= last
+
+
+def mca_regions(
+    listing: Listing, selections: Sequence[Tuple[str, Callable[[AsmLine], bool]]]
+) -> Tuple[List[Tuple[str, List[str]]], List[str]]:
+    """Return the instructions to analyse for each named selection, which are
+    each innermost loop mostly made of selected instructions (named by its
+    label), and the names of the selections which have no such loop"""
+    regions, without_loops = [], []
+    for name, wanted in selections:
+        selected = select_loops(listing, wanted)
+        for start, end in selected:
+            # name each loop by the label its backward branch jumps to
+            branch = listing.instructions[end].text
+            label = branch.split(",")[-1].split()[-1] if len(selected) > 1 else ""
+            body = listing.instructions[start : end + 1]
+            regions.append((f"{name} {label}".strip(), [ins.text for ins in body]))
+        if not selected:
+            without_loops.append(name)
+    return regions, without_loops
+
+
+def mca_input(regions: Sequence[Tuple[str, Sequence[str]]], comment: str) -> str:
+    "Return assembly with each region of instructions marked for llvm-mca"
+    lines = []
+    for name, instructions in regions:
+        lines.append(f"{comment} LLVM-MCA-BEGIN {name}")
+        lines.extend(f"\t{ins}" for ins in instructions)
+        lines.append(f"{comment} LLVM-MCA-END")
+    return "\n".join(lines) + "\n"
+
+
+class MCARegion(NamedTuple):
+    name: str
+    summary: Dict[str, float]
+    pressure: Dict[str, float]
+    bottleneck: str
+
+
+def parse_mca(text: str) -> List[MCARegion]:
+    "Parse the report of llvm-mca -bottleneck-analysis into its code regions"
+    regions = []
+    parts = re.split(r"^\[\d+\] Code Region(?: - (.*))?$", text, flags=re.M)
+    for name, body in zip(parts[1::2], parts[2::2]):
+        summary = {
+            key: float(value)
+            for key, value in re.findall(r"^([A-Za-z][\w ]+):\s+([\d.]+)$", body, re.M)
+        }
+        resources = dict(re.findall(r"^\[(\d+)\]\s+- (\S+)", body, re.M))
+        pressure: Dict[str, float] = {}
+        table = re.search(
+            r"^Resource pressure per iteration:\n(.*)\n(.*)$", body, flags=re.M
+        )
+        if table:
+            columns = re.findall(r"\[(\d+)\]", table.group(1))
+            for column, value in zip(columns, table.group(2).split()):
+                if column in resources:
+                    pressure[resources[column]] = 0.0 if value == "-" else float(value)
+        regions.append(MCARegion(name or "", summary, pressure, _bottleneck(body)))
+    return regions
+
+
+def _bottleneck(body: str) -> str:
+    """Summarise llvm-mca's bottleneck analysis as each cause of backend
+    pressure with its largest contributor, most significant first"""
+    found = re.search(r"^Throughput Bottlenecks:.*\n((?:  .*\n?)+)", body, re.M)
+    if found is None:
+        return "none"
+    causes: List[List] = []
+    for line in found.group(1).splitlines():
+        match = re.match(r"^  (- )?(.*?)\s*\[ ([\d.]+)% \]", line)
+        if match is None:
+            continue
+        sub, name, percent = match.groups()
+        if not sub:
+            causes.append([name.rstrip(":"), float(percent), "", 0.0])
+        elif causes and float(percent) > causes[-1][3]:
+            causes[-1][2:] = [name, float(percent)]
+    causes.sort(key=lambda cause: -cause[1])
+    return ", ".join(
+        f"{name} {percent:.1f}%" + (f" ({worst})" if worst else "")
+        for name, percent, worst, _ in causes
+        if percent > 0
+    )
+
+
+def _source_line(source_lines: Sequence[str], line: int) -> str:
+    return source_lines[line - 1].rstrip() if line <= len(source_lines) else ""
+
+
+def render(functions: Sequence[Function], source_lines: Sequence[str]) -> MimeBundle:
+    """Render the disassembly of functions as text and highlighted HTML, with
+    the source lines each instruction came from interleaved and loop back-edges
+    marked"""
+    text: List[str] = []
+    html: List[str] = ["<pre>"]
+    for function in functions:
+        edges = back_edges(function)
+        heads = set(edges.values())
+        text.append(f"{function.name}:")
+        html.append(f'<b style="color: #8172b3">{escape(function.name)}:</b>')
+        line = None
+        for ins in function.instructions:
+            if ins.line is not None and ins.line != line:
+                line = ins.line
+                code = f"    {line:4d} | {_source_line(source_lines, line)}"
+                text.append(code)
+                html.append(f'<span style="color: #6a737d">{escape(code)}</span>')
+            operands = ins.operands
+            if ins.relocation:
+                operands = f"{operands}  # {ins.relocation}"
+            note = ""
+            if ins.address in edges:
+                note = f"  <-- loop back-edge to {edges[ins.address]:x}"
+            head = ins.address in heads
+            text.append(
+                f"  {'>' if head else ' '}{ins.address:6x}:  "
+                f"{ins.mnemonic:8s} {operands}{note}".rstrip()
+            )
+            colour = "#c44e52" if ins.target is not None else "#4c72b0"
+            parts = [
+                f'<span style="color: #dd8452">{"&#9654;" if head else " "}</span>',
+                f'<span style="color: #999">{ins.address:6x}:</span>  ',
+                f'<b style="color: {colour}">{escape(ins.mnemonic):8s}</b> ',
+                escape(operands),
+            ]
+            if note:
+                parts.append(f'<b style="color: #dd8452">{escape(note)}</b>')
+            html.append("".join(parts))
+        text.append("")
+        html.append("")
+    html.append("</pre>")
+    return {"text/plain": "\n".join(text), "text/html": "\n".join(html)}
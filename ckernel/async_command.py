@@ -111,6 +111,8 @@ class AsyncCommand:
             yield
             task.cancel()
         else:
+            # nothing will ever be written, so don't leave the process waiting
+            proc_stdin.close()
             yield
 
     async def gather_data(self, lines: list[str], reader: asyncio.StreamReader) -> None:
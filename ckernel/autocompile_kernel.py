@@ -3,28 +3,65 @@
 from __future__ import annotations
 
 import asyncio
+import glob
 import json
 import os
+import platform
+import random
+import re
+import shlex
 import shutil
+import statistics
 import sys
+import time
 from argparse import Namespace
 from contextlib import contextmanager
-from typing import List, Optional
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
 
-from . import resource
-from .async_command import AsyncCommand
+from . import (
+    assembly,
+    bolt,
+    codesize,
+    compiletime,
+    dwarf,
+    experiments,
+    export,
+    lto,
+    mpi,
+    pgo,
+    profilers,
+    profiles,
+    remarks,
+    report,
+    resource,
+    symbols,
+    unity,
+)
+from .async_command import AsyncCommand, StreamConsumer
+from .cache import ArtifactCache, file_digest
 from .trigger import SysVSemTrigger
 from .base_kernel import BaseKernel
 from .util import (
     STDERR,
+    STDOUT,
     Lang,
+    Stream,
+    allocator_libraries,
     error,
     error_from_exception,
+    find_library,
+    find_program,
     get_environment_variables,
+    isa_levels,
     language,
+    preload_variable,
+    remove_file,
     success,
     switch_directory,
     temporary_directory,
+    timing_summary,
+    transparent_hugepage_mode,
     is_macOS,
 )
 
@@ -45,7 +82,38 @@ class AutoCompileKernel(BaseKernel):
         "ARGS",
         "NOCOMPILE",
         "NOEXEC",
+        "ALLOCATOR",
+        "HUGEPAGES",
+        "BENCHMARK",
+        "PTHREAD_TRACE",
+        "OMP_PROFILE",
+        "SCALING",
+        "MPI",
+        "MPI_PROFILE",
+        "SWEEP",
+        "CAPTURE",
+        "SPECIALIZE",
+        "AUTOTUNE",
+        "COMPILERS",
+        "ISA",
+        "ASM",
+        "ASMDIFF",
+        "REMARKS",
+        "MCA",
+        "LAYOUT",
+        "COMPILETIME",
+        "SIZE",
+        "PROFILE_BUILD",
+        "LTO",
+        "PGO",
+        "BOLT",
+        "UNITY",
     ]
+    _default_repeats = 10
+    _default_autotune_budget = 60
+    _default_ranks = 2
+    _default_compiletime_rows = 15
+    _default_size_rows = 20
 
     def __init__(self, *args, **kwargs):
         self.env = get_environment_variables(default="")
@@ -59,6 +127,52 @@ class AutoCompileKernel(BaseKernel):
         # store active command(s) for safe termination
         self._active_commands: set[AsyncCommand] = set()
 
+        # preload shims are compiled on first use
+        self._shims: Dict[str, Path] = {}
+
+        # variant objects and executables built during the session, kept
+        # apart for each build profile, see artifact_cache
+        self._caches: Dict[str, ArtifactCache] = {}
+
+        # the build profiles installed with the kernel, and the profile used
+        # for cells which don't choose one ("" for none)
+        self.profiles = profiles.load(self.env.CKERNEL_PROFILES)
+        self.profile = self.env.CKERNEL_PROFILE
+
+        # the profile each cell was last built with, by object name, so that
+        # switching profiles can reuse the builds cached for the new one
+        self._built_profiles: Dict[str, str] = {}
+        if self.shell is not None:
+            self.shell.register_magic_function(
+                self.ckernel_magic, magic_kind="line", magic_name="ckernel"
+            )
+
+        # "gcc" or "clang" for each compiler used, see compiler_family
+        self._compiler_families: Dict[str, str] = {}
+
+        # how the object of each cell was compiled, by object name, so that
+        # cells which link them with LTO can compile them again for LTO and
+        # cells built with UNITY can find their sources
+        self._cell_objects: Dict[str, lto.CellObject] = {}
+
+        # the symbols defined and used by each cell's object, to find the
+        # objects a cell must be linked with
+        self._symbols = symbols.SymbolIndex()
+
+        # the directory of the profile each cell was last trained with by PGO,
+        # to tell when a cell's profile is stale
+        self._pgo_profiles: Dict[str, Path] = {}
+
+        # the sizes of each cell's last build, to show how SIZE changes
+        self._sizes: Dict[str, codesize.Sizes] = {}
+
+        # the commands which built each cell's object or executable, by
+        # output, for %ckernel export-build
+        self._builds: Dict[str, export.Step] = {}
+
+        # the MPI launcher is detected on first use
+        self._mpi_launcher: Optional[mpi.MPILauncher] = None
+
         # create a trigger for stdin
         self.stdin_trigger = SysVSemTrigger(logger=self.log)
         self.log_info("using trigger %s", self.stdin_trigger)
@@ -79,6 +193,12 @@ class AutoCompileKernel(BaseKernel):
             result, _, stderr = asyncio.get_event_loop().run_until_complete(
                 compile_cmd.run_silent()
             )
+        self._builds[str(self.ck_dyn_obj)] = export.Step(
+            str(self.ck_dyn_obj),
+            self.env.CKERNEL_CC,
+            f"{debug_flag} {eat_newline_flag}".strip(),
+            [str(resource.input_wrappers_src)],
+        )
         if result != 0:
             self.log_error("failed to compile %s to %s", ck_dyn_src, self.ck_dyn_obj)
             self.log_error("result: %s", result)
@@ -180,6 +300,15 @@ class AutoCompileKernel(BaseKernel):
         if args.compiler is None or not args.should_compile:
             # No compiler means nothing to compile, so exit
             return success(self.execution_count)
+        await self.apply_profile(args)
+
+        self._cell_objects[args.obj] = lto.CellObject(
+            args.compiler, args.cflags, args.filename
+        )
+        if args.unity:
+            self.prepare_unity(args)
+        if args.LTO and not await self.prepare_lto(args):
+            return error("CompileFailed", "Compilation failed")
 
         # Attempt to compile to .o. Do this silently at first, because if
         # successful we want to detect whether main was defined before
@@ -189,7 +318,18 @@ class AutoCompileKernel(BaseKernel):
         )
         self.debug_msg("attempt to compile to .o")
         self.log_info("attempt to compile to .o")
-        result, _, stderr = await compile_cmd.run_silent()
+        switched = self._built_profiles.get(args.obj, args.profile) != args.profile
+        cached_obj = self.cell_artifact(
+            args, ".o", args.compiler, args.cflags, args.LDFLAGS
+        )
+        reused = switched and cached_obj.exists()
+        if reused:
+            shutil.copyfile(cached_obj, args.obj)
+            result, stderr = 0, []
+        else:
+            result, _, stderr = await compile_cmd.run_silent()
+            if result == 0:
+                shutil.copyfile(args.obj, cached_obj)
 
         if result != 0:
             # failed to compile to .o, so report error
@@ -200,80 +340,1838 @@ class AutoCompileKernel(BaseKernel):
                 self.print(line, dest=STDERR, end="")
             return error("CompileFailed", "Compilation failed")
 
-        # compiled ok, continue to detect main
+        # compiled ok, so index its symbols and continue to detect main
+        obj_symbols = await self.object_symbols(args.obj)
+        if obj_symbols is not None:
+            self._symbols.add(args.obj, obj_symbols)
         self.debug_msg("detect whether main defined")
 
-        result, *_ = await self.command_detect_main(args.obj).run_silent()
-        if result != 0:
+        # it seems that on macOS `int main()` is compiled to the symbol `_main`
+        entry = "_main" if is_macOS else "main"
+        if obj_symbols is None or entry not in obj_symbols.defined:
             # main not defined, so repeat to asynchronously report compilation
             # to .o and stop
             self.debug_msg("main not defined: compile to .o and stop")
-            self.print(f"$> {compile_cmd}")
-            compile_cmd = self.command_compile(
-                args.compiler,
-                args.cflags,
-                args.LDFLAGS,
-                args.filename,
+            if reused:
+                self.print(f"reused {args.obj} built with {self.profile_name(args)}")
+            else:
+                self.print(f"$> {compile_cmd}")
+                compile_cmd = self.command_compile(
+                    args.compiler,
+                    args.cflags,
+                    args.LDFLAGS,
+                    args.filename,
+                    args.obj,
+                )
+                await compile_cmd.run_with_output(
+                    self.stream_stdout, self.stream_stderr
+                )
+            self._built_profiles[args.obj] = args.profile
+            self._builds[args.obj] = export.Step(
                 args.obj,
+                args.compiler,
+                f"{args.cflags} {args.LDFLAGS}".strip(),
+                [args.filename],
             )
-            await compile_cmd.run_with_output(self.stream_stdout, self.stream_stderr)
+            await self.report_generated_code(args, args.obj)
             return success(self.execution_count)
 
         # main was defined, so compile & link in one command & report, then attempt to execute
         self.debug_msg("main was defined: attempt to compile and run executable")
 
-        if args.language == Lang.C:
-            extra_cflags = self.env.CKERNEL_EXE_CFLAGS or ""
-        elif args.language == Lang.CPP:
-            extra_cflags = self.env.CKERNEL_EXE_CXXFLAGS or ""
-        else:
-            extra_cflags = ""
+        if not await self.resolve_depends(args):
+            return error("CompileFailed", "Symbols are defined more than once")
 
         # report to the user the compilation command *without* the input wrappers
         compile_exe_cmd = self.command_compile_exe(
             args.compiler,
-            extra_cflags + " " + args.cflags,
-            (self.env.CKERNEL_EXE_LDFLAGS or "") + " " + args.LDFLAGS,
+            args.exe_cflags + " " + args.cflags,
+            args.exe_ldflags + " " + args.LDFLAGS,
             args.filename,
             args.depends,
             args.exe,
         )
-        self.print(f"$> {compile_exe_cmd}")
-
-        # now add self.ck_dyn_obj to args.depends to add input wrappers
-        compile_exe_cmd = self.command_compile_exe(
+        cached_exe = self.cell_artifact(
+            args,
+            "",
             args.compiler,
-            extra_cflags + " " + args.cflags,
-            (self.env.CKERNEL_EXE_LDFLAGS or "") + " " + args.LDFLAGS,
-            args.filename,
-            f"{self.ck_dyn_obj} " + args.depends,
-            args.exe,
+            args.exe_cflags + " " + args.cflags,
+            args.exe_ldflags + " " + args.LDFLAGS,
+            *(f"{dep} {file_digest(dep)}" for dep in args.depends.split()),
         )
-        self.log_info(f"{compile_exe_cmd}")
+        if switched and cached_exe.exists():
+            self.print(f"reused {args.exe} built with {self.profile_name(args)}")
+            shutil.copy2(cached_exe, args.exe)
+        else:
+            self.print(f"$> {compile_exe_cmd}")
+
+            # now add self.ck_dyn_obj to args.depends to add input wrappers
+            compile_exe_cmd = self.command_compile_exe(
+                args.compiler,
+                args.exe_cflags + " " + args.cflags,
+                args.exe_ldflags + " " + args.LDFLAGS,
+                args.filename,
+                f"{self.ck_dyn_obj} " + args.depends,
+                args.exe,
+            )
+            self.log_info(f"{compile_exe_cmd}")
 
-        result, *_ = await compile_exe_cmd.run_with_output(
-            self.stream_stdout, self.stream_stderr
+            result, *_ = await compile_exe_cmd.run_with_output(
+                self.stream_stdout, self.stream_stderr
+            )
+            if result != 0:
+                return error("CompileFailed", "Compilation failed")
+            shutil.copy2(args.exe, cached_exe)
+        self._built_profiles[args.obj] = args.profile
+        self._builds[args.exe] = export.Step(
+            args.exe,
+            args.compiler,
+            f"{args.exe_cflags} {args.cflags}".strip(),
+            [args.filename, str(self.ck_dyn_obj)] + args.depends.split(),
+            f"{args.exe_ldflags} {args.LDFLAGS}".strip(),
+            compile_only=False,
         )
-        if result != 0:
-            return error("CompileFailed", "Compilation failed")
+        await self.report_generated_code(args, args.exe)
         if not args.should_exec:
             return success(self.execution_count)
-        run_exe = AsyncCommand(f"./{args.exe} {args.ARGS}", logger=self.log)
+        exe_env = await self.exe_environment(args)
+        if exe_env is None:
+            return error("LaunchFailed", "Failed to prepare the environment")
+        args.launcher = ""
+        stream_stdout, stream_stderr = self.stream_stdout, self.stream_stderr
+        rank_outputs: Optional[mpi.RankOutputs] = None
+        if args.ranks > 0:
+            launcher = await self.mpi_launcher()
+            if launcher is None:
+                return error("LaunchFailed", "No MPI launcher found")
+            launcher_env = " ".join(f"{k}={v}" for k, v in launcher.env.items())
+            args.launcher = f"{launcher_env} {launcher.launch(args.ranks)}".strip()
+            rank_outputs = mpi.RankOutputs(self.display, args.split_ranks)
+            stream_stdout = self.stream_ranks(STDOUT, launcher, rank_outputs)
+            stream_stderr = self.stream_ranks(STDERR, launcher, rank_outputs)
+        if args.SCALING:
+            return await self.run_scaling(args, exe_env)
+        if args.SWEEP:
+            return await self.run_sweep(args, exe_env)
+        if args.specialize:
+            return await self.run_specialize(args, exe_env)
+        if args.AUTOTUNE:
+            return await self.run_autotune(args, exe_env)
+        if args.COMPILERS:
+            return await self.run_compilers(args, exe_env)
+        if args.ISA:
+            return await self.run_isa(args, exe_env)
+        if args.PGO:
+            return await self.run_pgo(args, exe_env)
+        if args.bolt:
+            result = await self.run_bolt(args, exe_env)
+            if result is not None:
+                return result
+        run_exe = self.command_run_exe(args.exe, args.ARGS, exe_env, args.launcher)
         self.print(f"$> {run_exe}")
         with self.active_command(
             run_exe
         ) as command, self.stdin_trigger.ready() as trigger:
             result, *_ = await command.run_interactive(
-                self.stream_stdout,
-                self.stream_stderr,
+                stream_stdout,
+                stream_stderr,
                 self.write_input,
                 trigger,
             )
+        if rank_outputs is not None:
+            rank_outputs.flush()
         if result != 0:
             self.print(f"executable failed with exit code {result}", dest=STDERR)
             return error("ExeFailed", "Executable failed")
+        if args.pthread_trace:
+            await self.report_pthread_trace(args.exe)
+        if args.omp_profile:
+            await self.report_omp_profile(args.exe)
+        if args.mpi_profile:
+            self.report_mpi_profile(args.exe)
+        if args.repeats > 0:
+            result, times, _ = await self.benchmark(
+                self.command_run_exe(args.exe, args.ARGS, exe_env, args.launcher),
+                args.repeats,
+            )
+            if result != 0:
+                self.print(f"executable failed with exit code {result}", dest=STDERR)
+                return error("ExeFailed", "Executable failed")
+            self.print(f"benchmark: {timing_summary(times)}")
+        return success(self.execution_count)
+
+    async def exe_environment(self, args: Namespace) -> Optional[Dict[str, str]]:
+        """Get the environment variables to set when running the executable,
+        or None if they couldn't be prepared"""
+        env: Dict[str, str] = {}
+        preload: List[str] = []
+        if args.hugepages:
+            mode = transparent_hugepage_mode()
+            if mode == "never":
+                self.print(
+                    "transparent huge pages are disabled on this system", dest=STDERR
+                )
+            shim = await self.build_shim("ck_hugepages.c")
+            if shim is None:
+                return None
+            preload.append(str(shim))
+        if args.pthread_trace:
+            shim = await self.build_shim("ck_pthread_trace.c")
+            if shim is None:
+                return None
+            preload.append(str(shim))
+            env["CK_PTHREAD_TRACE"] = self.pthread_trace_file(args.exe)
+            remove_file(env["CK_PTHREAD_TRACE"])
+        if args.omp_profile:
+            shim = await self.build_shim("ck_ompt_tool.c")
+            if shim is None:
+                return None
+            env["OMP_TOOL_LIBRARIES"] = str(shim)
+            env["CK_OMPT_PROFILE"] = self.omp_profile_file(args.exe)
+            remove_file(env["CK_OMPT_PROFILE"])
+        if args.mpi_profile:
+            if args.ranks == 0:
+                self.print("MPI_PROFILE requires the MPI option", dest=STDERR)
+                return None
+            shim = await self.build_shim(
+                "ck_pmpi_profiler.c", self.env.CKERNEL_MPICC or "mpicc"
+            )
+            if shim is None:
+                return None
+            preload.append(str(shim))
+            env["CK_PMPI_PROFILE"] = self.mpi_profile_prefix(args.exe)
+            for path in glob.glob(f"{env['CK_PMPI_PROFILE']}.*.json"):
+                remove_file(path)
+        if args.ALLOCATOR:
+            allocator = args.ALLOCATOR.strip()
+            if allocator not in allocator_libraries:
+                known = ", ".join(allocator_libraries)
+                self.print(
+                    f"unknown allocator {allocator} (expected one of: {known})",
+                    dest=STDERR,
+                )
+                return None
+            if allocator_libraries[allocator]:
+                library = find_library(allocator_libraries[allocator])
+                if library is None:
+                    self.print(f"allocator {allocator} not found", dest=STDERR)
+                    return None
+                preload.append(library)
+        if preload:
+            env[preload_variable] = ":".join(preload)
+        return env
+
+    @staticmethod
+    def pthread_trace_file(exe: str) -> str:
+        return f"{exe}.trace.json"
+
+    async def report_pthread_trace(self, exe: str):
+        """Display the lock contention and thread timeline recorded for exe"""
+        path = self.pthread_trace_file(exe)
+        try:
+            with open(path, encoding="utf-8") as trace_file:
+                trace = json.load(trace_file)
+        except (OSError, ValueError) as err:
+            self.print(f"failed to read pthread trace {path}: {err}", dest=STDERR)
+            return
+        # the locks are named from the symbols of the files they're in
+        symbols = {}
+        for name in {lock.get("file") for lock in trace.get("ckLocks", [])}:
+            if name and os.path.isfile(name):
+                command = AsyncCommand(f"nm -S -C {shlex.quote(name)}")
+                _, nm_lines, _ = await command.run_silent()
+                symbols[name] = profilers.parse_nm(nm_lines)
+        for bundle in profilers.pthread_trace_report(trace, symbols):
+            self.display(bundle)
+        if trace.get("ckUntracedThreads"):
+            self.print(
+                f"{trace['ckUntracedThreads']} threads were created after the "
+                "first 1024 and weren't traced",
+                dest=STDERR,
+            )
+        self.print(f"pthread trace written to {path} (Chrome trace format)")
+
+    @staticmethod
+    def omp_profile_file(exe: str) -> str:
+        return f"{exe}.ompt.json"
+
+    async def report_omp_profile(self, exe: str):
+        """Display the OpenMP region profile recorded for exe"""
+        path = self.omp_profile_file(exe)
+        if not os.path.isfile(path):
+            self.print(
+                "no OpenMP profile was recorded: the OpenMP runtime may not "
+                "support OMPT (LLVM's libomp does)",
+                dest=STDERR,
+            )
+            return
+        try:
+            with open(path, encoding="utf-8") as profile_file:
+                profile = json.load(profile_file)
+        except (OSError, ValueError) as err:
+            self.print(f"failed to read OpenMP profile {path}: {err}", dest=STDERR)
+            return
+        # name the regions from the files their code is in
+        offsets: Dict[str, List[int]] = {}
+        for region in profile.get("regions", []):
+            offsets.setdefault(region.get("file", ""), []).append(region["offset"])
+        names = {}
+        for name, found in offsets.items():
+            if not name or not os.path.isfile(name):
+                continue
+            # the code pointer is a return address, so look up the call before it
+            addresses = " ".join(hex(offset - 1) for offset in found)
+            _, lines, _ = await AsyncCommand(
+                f"addr2line -f -C -e {shlex.quote(name)} {addresses}"
+            ).run_silent()
+            calls = profilers.parse_addr2line(lines, [offset - 1 for offset in found])
+            names.update(
+                ((name, offset + 1), call)
+                for offset, call in calls.items()
+                if call != hex(offset)
+            )
+        for bundle in profilers.ompt_profile_report(profile, names):
+            self.display(bundle)
+
+    @staticmethod
+    def mpi_profile_prefix(exe: str) -> str:
+        return f"{exe}.pmpi"
+
+    def report_mpi_profile(self, exe: str):
+        """Display the MPI communication profile recorded for exe"""
+        profiles = []
+        for path in glob.glob(f"{self.mpi_profile_prefix(exe)}.*.json"):
+            try:
+                with open(path, encoding="utf-8") as profile_file:
+                    profiles.append(json.load(profile_file))
+            except (OSError, ValueError) as err:
+                self.print(f"failed to read MPI profile {path}: {err}", dest=STDERR)
+        if not profiles:
+            self.print("no MPI profile was recorded", dest=STDERR)
+            return
+        for bundle in profilers.pmpi_profile_report(profiles):
+            self.display(bundle)
+
+    def command_run_exe(
+        self,
+        exe: str,
+        exe_args: str,
+        env: Optional[Dict[str, str]] = None,
+        launcher: str = "",
+    ) -> AsyncCommand:
+        env_vars = " ".join(f"{name}={value}" for name, value in (env or {}).items())
+        if launcher and env_vars:
+            # set the variables for each launched process, not the launcher
+            env_vars = f"env {env_vars}"
+        exe = os.path.join(".", exe)
+        command = " ".join(filter(None, [launcher, env_vars, exe, exe_args]))
+        return AsyncCommand(command, logger=self.log)
+
+    async def mpi_launcher(self) -> Optional[mpi.MPILauncher]:
+        """Detect the MPI launcher to use, or None if there isn't one"""
+        if self._mpi_launcher is None:
+            command = self.env.CKERNEL_MPIRUN or next(
+                filter(shutil.which, ["mpirun", "mpiexec"]), None
+            )
+            if command is None:
+                self.print("neither mpirun nor mpiexec were found", dest=STDERR)
+                return None
+            _, stdout, stderr = await AsyncCommand(f"{command} --version").run_silent()
+            self._mpi_launcher = mpi.detect_launcher(
+                command, "".join(stdout + stderr), as_root=(os.geteuid() == 0)
+            )
+            self.log_info("MPI launcher: %s", self._mpi_launcher)
+        return self._mpi_launcher
+
+    def stream_ranks(
+        self, dest: Stream, launcher: mpi.MPILauncher, outputs: mpi.RankOutputs
+    ) -> StreamConsumer:
+        """Return a stream consumer which labels each line of output with the
+        rank which produced it"""
+
+        async def consume(reader: asyncio.StreamReader) -> None:
+            async for data in reader:
+                rank, text = launcher.split_rank(data.decode())
+                if rank is None:
+                    self.print(text, dest=dest, end="")
+                elif not outputs.add(rank, text, dest):
+                    self.print(f"[rank {rank}] {text}", dest=dest, end="")
+
+        return consume
+
+    async def benchmark(
+        self, command: AsyncCommand, repeats: int
+    ) -> Tuple[int, List[float], List[str]]:
+        """Run a command repeatedly with its output captured, returning the
+        exit code, the wall-clock time of each run and the last run's stdout.
+        Stops at the first run which fails."""
+        times: List[float] = []
+        stdout: List[str] = []
+        for _ in range(repeats):
+            with self.active_command(command):
+                start = time.perf_counter()
+                result, stdout, _ = await command.run_silent()
+                times.append(time.perf_counter() - start)
+            if result != 0:
+                return result, times, stdout
+        return 0, times, stdout
+
+    async def time_exe(
+        self, command: AsyncCommand, repeats: int
+    ) -> Optional[Tuple[float, List[str]]]:
+        """Return the median wall-clock time of running command repeats times
+        (at least once) and its stdout, or None if it failed"""
+        self.print(f"$> {command}")
+        result, times, stdout = await self.benchmark(command, max(repeats, 1))
+        if result != 0:
+            self.print(f"executable failed with exit code {result}", dest=STDERR)
+            for line in stdout:
+                self.print(line, dest=STDERR, end="")
+            return None
+        return statistics.median(times), stdout
+
+    async def run_scaling(self, args: Namespace, exe_env: Dict[str, str]):
+        """Run the executable once per thread count and report its scaling"""
+        try:
+            params = experiments.parse_parameters(args.SCALING)
+            threads = [int(count) for count in params.get("threads", [])]
+        except ValueError:
+            params, threads = {}, []
+        mode = params.get("mode", ["strong"])[0]
+        if not threads or min(threads) < 1 or mode not in ("strong", "weak"):
+            message = "expected SCALING threads=n1,n2,... [mode=strong|weak]"
+            self.print(message, dest=STDERR)
+            return error("BadOption", message)
+        if mode == "weak" and not experiments.scales_with_threads(args.ARGS):
+            # without a placeholder the problem size wouldn't grow with threads
+            message = "SCALING mode=weak needs {threads} or {n*threads} in ARGS"
+            self.print(message, dest=STDERR)
+            return error("BadOption", message)
+        if max(threads) > (os.cpu_count() or 1):
+            self.print(
+                f"warning: more threads than the {os.cpu_count()} available CPUs",
+                dest=STDERR,
+            )
+        times: List[float] = []
+        for count in threads:
+            env = dict(exe_env)
+            env.setdefault("OMP_PROC_BIND", "close")
+            env.setdefault("OMP_PLACES", "cores")
+            env["OMP_NUM_THREADS"] = str(count)
+            exe_args = experiments.substitute_threads(args.ARGS, count)
+            command = self.command_run_exe(args.exe, exe_args, env, args.launcher)
+            timed = await self.time_exe(command, args.repeats)
+            if timed is None:
+                return error("ExeFailed", "Executable failed")
+            times.append(timed[0])
+        rows = experiments.scaling_metrics(threads, times, weak=(mode == "weak"))
+        headers = ["threads", "time (s)", "speed-up", "efficiency %", "Karp-Flatt"]
+        self.display(report.table(headers, rows, title=f"{mode.title()} scaling"))
+        ideal = [count / threads[0] for count in threads]
+        self.display(
+            report.line_chart(
+                threads,
+                {"measured": [row[2] for row in rows], "ideal": ideal},
+                title="Speed-up",
+                xlabel="threads",
+                ylabel="speed-up",
+            )
+        )
+        self.display(
+            report.line_chart(
+                threads,
+                {"efficiency": [row[3] for row in rows]},
+                title="Parallel efficiency",
+                xlabel="threads",
+                ylabel="efficiency %",
+            )
+        )
+        return success(self.execution_count)
+
+    async def run_sweep(self, args: Namespace, exe_env: Dict[str, str]):
+        """Run the executable for every combination of the swept parameters,
+        which are substituted into ARGS and set in the environment. Runs are
+        concurrent unless benchmarking, which runs them one at a time."""
+        try:
+            points = experiments.expand(experiments.parse_parameters(args.SWEEP))
+        except ValueError as err:
+            self.print(f"SWEEP {err}", dest=STDERR)
+            return error("BadOption", str(err))
+        try:
+            pattern = re.compile(args.CAPTURE.strip()) if args.CAPTURE else None
+        except re.error as err:
+            self.print(f"CAPTURE is not a valid pattern: {err}", dest=STDERR)
+            return error("BadOption", str(err))
+        limit = asyncio.Semaphore(1 if args.repeats > 0 else os.cpu_count() or 1)
+
+        async def run_point(point: Dict[str, str]):
+            exe_args = experiments.substitute(args.ARGS, point)
+            env = {**exe_env, **point}
+            command = self.command_run_exe(args.exe, exe_args, env, args.launcher)
+            async with limit:
+                return await self.time_exe(command, args.repeats)
+
+        results = await asyncio.gather(*(run_point(point) for point in points))
+        if any(timed is None for timed in results):
+            return error("ExeFailed", "Executable failed")
+        captures = [experiments.capture(pattern, stdout) for _, stdout in results]
+        times = [time for time, _ in results]
+        headers = [*points[0], "time (s)", *captures[0]]
+        rows = [
+            [*point.values(), time, *captured.values()]
+            for point, time, captured in zip(points, times, captures)
+        ]
+        self.display(report.table(headers, rows, title="Sweep"))
+        first = next(iter(points[0]))
+        charts = [("time (s)", times)] + [
+            (name, [experiments.to_number(c[name]) for c in captures])
+            for name in captures[0]
+        ]
+        for name, values in charts:
+            arranged = experiments.series_by_first(points, values)
+            if arranged is not None and None not in values:
+                xs, series = arranged
+                self.display(
+                    report.line_chart(
+                        xs, series, title=name, xlabel=first, ylabel=name
+                    )
+                )
+        return success(self.execution_count)
+
+    async def prepare_lto(self, args: Namespace) -> bool:
+        """Add the flags for link-time optimisation and replace the objects of
+        other cells in DEPENDS with objects compiled again for LTO, which
+        are kept apart from the cells' own objects in the artifact cache.
+        Return False if an object failed to compile."""
+        try:
+            options = lto.parse_options(args.LTO)
+        except ValueError as exc:
+            self.print(str(exc), dest=STDERR)
+            return False
+        family = await self.compiler_family(args.compiler)
+        args.lto_flag = lto.compile_flag(options.mode, family)
+        link_flags = lto.link_flags(options, family, os.cpu_count() or 1)
+        args.cflags = f"{args.cflags} {args.lto_flag}"
+        args.exe_ldflags = f"{args.exe_ldflags} {link_flags}".strip()
+        depends = []
+        for dep in args.depends.split():
+            obj = await self.lto_object(args, dep)
+            if obj is None:
+                return False
+            depends.append(obj)
+        args.depends = " ".join(depends)
+        return True
+
+    async def lto_object(self, args: Namespace, dep: str) -> Optional[str]:
+        """Return the object of another cell compiled again for the cell's LTO
+        link, or dep itself if it wasn't compiled by a cell. Return None if it
+        failed to compile."""
+        cell = self._cell_objects.get(dep)
+        if cell is None:
+            self.print(f"{dep} wasn't compiled by a cell, so is linked without LTO")
+            return dep
+        cflags = f"{cell.cflags} {args.lto_flag}"
+        variant = experiments.Variant(dep, cell.compiler, cflags)
+        obj = await self.compile_variant(
+            Namespace(**{**vars(args), "filename": cell.filename}), variant
+        )
+        if obj is None:
+            return None
+        self._builds[str(obj)] = export.Step(
+            str(obj), cell.compiler, cflags, [cell.filename]
+        )
+        return str(obj)
+
+    def prepare_unity(self, args: Namespace):
+        """Replace the cell's source with a generated source which concatenates
+        the sources of the other cells in DEPENDS and the cell's own, so that
+        they compile once as a single translation unit, and drop their objects
+        from the link. The generated source is kept in the kernel's working
+        directory."""
+        cells, depends, directories = [], [], []
+        for dep in args.depends.split():
+            cell = self._cell_objects.get(dep)
+            if cell is None:
+                self.print(f"{dep} wasn't compiled by a cell, so is linked as it is")
+                depends.append(dep)
+                continue
+            if cell.compiler != args.compiler or cell.cflags != args.cflags:
+                self.print(f"{cell.filename} is compiled with the flags of this cell")
+            cells.append(cell.filename)
+        cells.append(args.filename)
+        sources = []
+        for filename in cells:
+            with open(filename, encoding="utf-8") as src:
+                sources.append(unity.Cell(filename, src.read()))
+            directory = str(Path(filename).resolve().parent)
+            if directory not in directories:
+                directories.append(directory)
+        source = self.twd / "unity" / Path(args.filename).name
+        source.parent.mkdir(exist_ok=True)
+        source.write_text(unity.generate(sources), encoding="utf-8")
+        self.print(f"unity build of {' '.join(cells)} in {source}")
+        # the cells' own headers are found beside the cells, not the unit
+        include = " ".join(f"-iquote {shlex.quote(d)}" for d in directories)
+        args.cflags = f"{args.cflags} {include}".strip()
+        args.filename = str(source)
+        args.depends = " ".join(depends)
+
+    async def object_symbols(self, obj: str) -> Optional[symbols.ObjectSymbols]:
+        """Return the symbols of an object, or None if it can't be read. GNU nm
+        can't read the LLVM bitcode of Clang's LTO objects without the LLVMgold
+        plugin, so llvm-nm is tried too if nm fails or finds no symbols."""
+        for program in ["nm", find_program("llvm-nm")]:
+            if program is None:
+                continue
+            command = AsyncCommand(f"{program} -P {obj}", logger=self.log)
+            result, stdout, _ = await command.run_silent()
+            if result == 0 and stdout:
+                return symbols.parse_nm(stdout)
+        return None
+
+    async def resolve_depends(self, args: Namespace) -> bool:
+        """Add to DEPENDS the objects of other cells which define the symbols
+        that the cell and its DEPENDS use but don't define, and report any
+        symbol which the objects to be linked, or the objects which could be
+        added, define more than once. Return False if the link would fail
+        for that reason."""
+        self._symbols.objects = {
+            obj: found
+            for obj, found in self._symbols.objects.items()
+            if os.path.exists(obj)
+        }
+        linked = {}
+        for obj in [args.obj] + args.depends.split():
+            found = self._symbols.objects.get(obj) or await self.object_symbols(obj)
+            if found is not None:
+                linked[obj] = found
+        added, ambiguous = self._symbols.resolve(linked)
+        names = await self.demangle(sorted(ambiguous))
+        for name, objs in ambiguous.items():
+            self.print(
+                f"{names[name]} is defined by {', '.join(objs)}: "
+                "list the one to link in DEPENDS",
+                dest=STDERR,
+            )
+        if added:
+            self.print(f"added {' '.join(added)} to DEPENDS")
+            linked.update((obj, self._symbols.objects[obj]) for obj in added)
+            if args.LTO:
+                # link the added objects compiled for LTO too
+                for k, obj in enumerate(added):
+                    lto_obj = await self.lto_object(args, obj)
+                    if lto_obj is None:
+                        return False
+                    added[k] = lto_obj
+            args.depends = " ".join(args.depends.split() + added)
+        clashes = symbols.duplicates(linked)
+        names = await self.demangle(sorted(clashes))
+        for name, objs in clashes.items():
+            self.print(
+                f"{names[name]} is defined by each of {', '.join(objs)}",
+                dest=STDERR,
+            )
+        return not clashes and not ambiguous
+
+    async def apply_profile(self, args: Namespace):
+        """Put the flags of the cell's build profile before the cell's own, so
+        that the cell's flags take precedence. The cell's flags without the
+        profile's are kept for building with other compilers."""
+        args.own_cflags, args.own_ldflags = args.cflags, args.exe_ldflags
+        flags, link_flags = await self.profile_flags(args, args.compiler)
+        args.cflags = f"{flags} {args.cflags}".strip()
+        args.base_cflags = f"{flags} {args.base_cflags}".strip()
+        args.exe_ldflags = f"{args.exe_ldflags} {link_flags}".strip()
+
+    async def profile_flags(self, args: Namespace, compiler: str) -> Tuple[str, str]:
+        """Return the compile and link flags of the cell's build profile for a
+        compiler, since some of them depend on its family"""
+        if not args.profile:
+            return "", ""
+        profile = self.profiles[args.profile]
+        clang = await self.compiler_family(compiler) == "clang"
+        return profile.compile_flags(clang), profile.link_flags(clang)
+
+    @staticmethod
+    def profile_name(args: Namespace) -> str:
+        return f"profile {args.profile}" if args.profile else "no profile"
+
+    def cell_artifact(self, args: Namespace, suffix: str, *inputs: str) -> Path:
+        """Return where the cell's own object or executable, built from its
+        sources with the given inputs, is kept in its profile's artifact cache"""
+        with open(args.filename, encoding="utf-8") as src:
+            sources = [src.read()] + experiments.local_includes(args.filename)
+        return self.artifact_cache(args).path(suffix, *inputs, *sources)
+
+    def artifact_cache(self, args: Namespace) -> ArtifactCache:
+        "Return the artifact cache for the cell's build profile"
+        namespace = args.profile or "default"
+        if namespace not in self._caches:
+            self._caches[namespace] = ArtifactCache(self.twd / "cache" / namespace)
+        return self._caches[namespace]
+
+    async def compile_variant(
+        self, args: Namespace, variant: experiments.Variant
+    ) -> Optional[Path]:
+        """Compile the cell as a variant object in the artifact cache, returning
+        its path or None if it failed to compile. The object is reused if its
+        compiler, flags and sources are unchanged."""
+        with open(args.filename, encoding="utf-8") as src:
+            sources = [src.read()] + experiments.local_includes(args.filename)
+        cache = self.artifact_cache(args)
+        obj = cache.path(".o", variant.compiler, variant.cflags, *sources)
+        if obj.exists():
+            return obj
+        command = self.command_compile(
+            variant.compiler, variant.cflags, "", args.filename, obj
+        )
+        self.log_info("%s", command)
+        result, _, stderr = await command.run_silent()
+        if result != 0:
+            self.print(f"failed to compile variant {variant.label}", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            remove_file(obj)
+            return None
+        return obj
+
+    async def build_variant(
+        self, args: Namespace, variant: experiments.Variant
+    ) -> Optional[Tuple[Path, float]]:
+        """Build the cell as a variant executable in the artifact cache,
+        returning its path and the build time, or None if the build failed"""
+        variant = variant._replace(cflags=f"{args.exe_cflags} {variant.cflags}")
+        start = time.perf_counter()
+        obj = await self.compile_variant(args, variant)
+        if obj is None:
+            return None
+        # the executable is named by everything linked into it, not just the object
+        exe_ldflags = args.exe_ldflags if variant.ldflags is None else variant.ldflags
+        ldflags = f"{variant.cflags} {exe_ldflags} {args.LDFLAGS}"
+        depends = [str(self.ck_dyn_obj)] + args.depends.split()
+        exe = self.artifact_cache(args).path(
+            "",
+            str(obj),
+            ldflags,
+            *(f"{dep} {file_digest(dep)}" for dep in depends),
+        )
+        command = self.command_link_exe(
+            variant.compiler, ldflags, exe, obj, " ".join(depends)
+        )
+        self.log_info("%s", command)
+        result, _, stderr = await command.run_silent()
+        if result != 0:
+            self.print(f"failed to link variant {variant.label}", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return None
+        return exe, time.perf_counter() - start
+
+    async def build_variants(
+        self, args: Namespace, variants: List[experiments.Variant]
+    ) -> List[Optional[Tuple[Path, float]]]:
+        """Build variants concurrently on the available cores"""
+        limit = asyncio.Semaphore(os.cpu_count() or 1)
+
+        async def build(variant: experiments.Variant):
+            async with limit:
+                return await self.build_variant(args, variant)
+
+        if variants:
+            self.print(f"building {len(variants)} variant(s)")
+        return await asyncio.gather(*(build(variant) for variant in variants))
+
+    async def measure_variants(
+        self,
+        args: Namespace,
+        exe_env: Dict[str, str],
+        variants: List[experiments.Variant],
+        repeats: int,
+    ) -> List[experiments.VariantResult]:
+        """Build variants concurrently, then time each one that built in turn
+        so that the runs don't interfere"""
+        builds = await self.build_variants(args, variants)
+        results = []
+        for variant, build in zip(variants, builds):
+            if build is None:
+                results.append(experiments.VariantResult(variant, None, None, None, []))
+                continue
+            exe, build_time = build
+            command = self.command_run_exe(str(exe), args.ARGS, exe_env, args.launcher)
+            result, times, stdout = await self.benchmark(command, max(repeats, 1))
+            if result != 0:
+                self.print(
+                    f"{variant.label}: failed with exit code {result}", dest=STDERR
+                )
+                results.append(
+                    experiments.VariantResult(variant, str(exe), build_time, None, [])
+                )
+                continue
+            run_time = statistics.median(times)
+            self.print(f"{variant.label}: {run_time:.6f} s")
+            results.append(
+                experiments.VariantResult(
+                    variant, str(exe), build_time, run_time, stdout
+                )
+            )
+        return results
+
+    async def run_specialize(self, args: Namespace, exe_env: Dict[str, str]):
+        """Build and time a variant for every combination of the specialised
+        macro values"""
+        with open(args.filename, encoding="utf-8") as src:
+            code = src.read()
+        # macros the cell never mentions can't change the build
+        parameters = experiments.used_macros(code, args.specialize)
+        for name in args.specialize.keys() - parameters.keys():
+            self.print(f"{name} does not appear in the cell, ignoring it")
+        if not parameters:
+            return error("SpecializeFailed", "No macro to specialise is used")
+        points = experiments.expand(parameters)
+        variants = []
+        for point in points:
+            defines = " ".join(f"-D{name}={value}" for name, value in point.items())
+            label = " ".join(f"{name}={value}" for name, value in point.items())
+            variants.append(
+                experiments.Variant(
+                    label, args.compiler, f"{args.base_cflags} {defines}"
+                )
+            )
+        results = await self.measure_variants(args, exe_env, variants, args.repeats)
+        if any(result.build_time is None for result in results):
+            return error("CompileFailed", "Compilation failed")
+        if any(result.time is None for result in results):
+            return error("ExeFailed", "Executable failed")
+        fastest = min(results, key=lambda result: result.time)
+        # speed-up is relative to the first values, which the cell's own build uses
+        headers = [*points[0], "build (s)", "time (s)", "speed-up"]
+        rows = sorted(
+            (
+                [
+                    *point.values(),
+                    result.build_time,
+                    result.time,
+                    results[0].time / result.time,
+                ]
+                for point, result in zip(points, results)
+            ),
+            key=lambda row: row[-2],
+        )
+        self.display(report.table(headers, rows, title="Specialised variants"))
+        self.print(f"fastest: {fastest.variant.label} ({fastest.time:.6f} s)")
+        return success(self.execution_count)
+
+    async def run_autotune(self, args: Namespace, exe_env: Dict[str, str]):
+        """Search a space of compiler flags for the fastest build whose output
+        matches the cell's own build, within a time budget"""
+        family = await self.compiler_family(args.compiler)
+        settings, space = experiments.parse_flag_space(args.AUTOTUNE, family)
+        search = settings.get("search", "greedy")
+        try:
+            budget = float(settings.get("budget", self._default_autotune_budget))
+        except ValueError:
+            budget = -1.0
+        if budget <= 0 or search not in ("greedy", "random"):
+            message = (
+                "expected AUTOTUNE [budget=seconds] [search=greedy|random] "
+                "[flag|flag ...]"
+            )
+            self.print(message, dest=STDERR)
+            return error("BadOption", message)
+        repeats = args.repeats or self._default_repeats
+        start = time.monotonic()
+
+        # the cell's own build is the baseline for timing and output
+        command = self.command_run_exe(args.exe, args.ARGS, exe_env, args.launcher)
+        baseline = await self.time_exe(command, repeats)
+        if baseline is None:
+            return error("ExeFailed", "Executable failed")
+        base_time, expected = baseline
+        # the budget is for the variants, so starts after the baseline
+        deadline = time.monotonic() + budget
+
+        results: Dict[Tuple[int, ...], experiments.VariantResult] = {}
+
+        def run_time(choice: Tuple[int, ...]) -> float:
+            "the choice's time, or infinity if it failed or its output differs"
+            result = results.get(choice)
+            if result is None or result.time is None or result.stdout != expected:
+                return float("inf")
+            return result.time
+
+        async def evaluate(choices: List[Tuple[int, ...]]):
+            variants = []
+            for choice in choices:
+                chosen = experiments.flags(space, choice)
+                label = chosen or "(no flags)"
+                variants.append(
+                    experiments.Variant(label, args.compiler, f"{args.cflags} {chosen}")
+                )
+            measured = await self.measure_variants(args, exe_env, variants, repeats)
+            results.update(zip(choices, measured))
+
+        if search == "greedy":
+            # improve one group of flags at a time until no change helps
+            best = tuple(0 for _ in space)
+            await evaluate([best])
+            improved = True
+            while improved and time.monotonic() < deadline:
+                improved = False
+                for group in range(len(space)):
+                    if time.monotonic() >= deadline:
+                        break
+                    choices = experiments.neighbours(space, best, group)
+                    await evaluate([c for c in choices if c not in results])
+                    choice = min(choices, key=run_time)
+                    if run_time(choice) < run_time(best):
+                        best, improved = choice, True
+        else:
+            rng = random.Random(settings.get("seed"))
+            # evaluate at least one batch, as greedy search does
+            while not results or time.monotonic() < deadline:
+                choices = experiments.random_choices(
+                    space, os.cpu_count() or 1, results, rng
+                )
+                if not choices:
+                    break
+                await evaluate(choices)
+        if not results:
+            self.print("no variants were evaluated")
+            return success(self.execution_count)
+
+        rows = []
+        ranked = sorted(results, key=run_time)
+        for result in (results[choice] for choice in ranked):
+            if result.build_time is None:
+                status = "build failed"
+            elif result.time is None:
+                status = "run failed"
+            elif result.stdout != expected:
+                status = "output differs"
+            else:
+                status = "ok"
+            speedup = base_time / result.time if status == "ok" else ""
+            rows.append(
+                [
+                    result.variant.label,
+                    "" if result.build_time is None else result.build_time,
+                    "" if result.time is None else result.time,
+                    speedup,
+                    status,
+                ]
+            )
+        self.display(
+            report.table(
+                ["flags", "build (s)", "time (s)", "speed-up", "status"],
+                rows,
+                title="Autotuned variants",
+            )
+        )
+        self.print(
+            f"tried {len(results)} flag sets in {time.monotonic() - start:.1f} s "
+            f"(baseline {base_time:.6f} s)"
+        )
+        best = min(results, key=run_time)
+        if run_time(best) >= base_time:
+            self.print("no variant was faster than the cell's own flags")
+        else:
+            option = "CFLAGS" if args.language == Lang.C else "CXXFLAGS"
+            chosen = experiments.flags(space, best)
+            cflags = args.cflags
+            if re.search(r"(^|\s)-O", chosen):
+                # the chosen optimisation level replaces the cell's own
+                cflags = re.sub(r"(^|\s)-O\S*", "", cflags)
+            chosen = f"{cflags} {chosen}".strip()
+            self.print(
+                f"fastest: {base_time / run_time(best):.3g}x speed-up with\n"
+                f"{self._tag_opt} {option} {chosen}"
+            )
+        return success(self.execution_count)
+
+    async def run_compilers(self, args: Namespace, exe_env: Dict[str, str]):
+        """Build and time the cell with each of several compilers"""
+        compilers = []
+        for compiler in filter(None, args.COMPILERS.replace(",", " ").split()):
+            if shutil.which(compiler) is None:
+                self.print(f"{compiler} was not found, skipping it", dest=STDERR)
+            else:
+                compilers.append(compiler)
+        if not compilers:
+            return error("CompileFailed", "None of the compilers was found")
+        # the profile's flags are chosen for each compiler's family
+        variants = []
+        for cc in compilers:
+            flags, link_flags = await self.profile_flags(args, cc)
+            variants.append(
+                experiments.Variant(
+                    cc,
+                    cc,
+                    f"{flags} {args.own_cflags}".strip(),
+                    f"{args.own_ldflags} {link_flags}".strip(),
+                )
+            )
+        results = await self.measure_variants(args, exe_env, variants, args.repeats)
+        timed = [result for result in results if result.time is not None]
+        if not timed:
+            return error("ExeFailed", "No variant built and ran")
+        # compare speed and output with the first compiler which worked
+        reference = timed[0]
+        rows = []
+        for result in results:
+            row = [result.variant.label, "", "", "", "", ""]
+            if result.build_time is None:
+                row[-1] = "build failed"
+            elif result.time is None:
+                row[1:3] = result.build_time, os.path.getsize(result.exe)
+                row[-1] = "run failed"
+            else:
+                row[1:] = [
+                    result.build_time,
+                    os.path.getsize(result.exe),
+                    result.time,
+                    reference.time / result.time,
+                    "same" if result.stdout == reference.stdout else "differs",
+                ]
+            rows.append(row)
+        headers = ["compiler", "build (s)", "size (B)", "time (s)", "speed-up"]
+        headers.append("output")
+        title = f"Compilers (relative to {reference.variant.label})"
+        self.display(report.table(headers, rows, title=title))
+        return success(self.execution_count)
+
+    async def run_isa(self, args: Namespace, exe_env: Dict[str, str]):
+        """Build and time the cell for each instruction-set level the host CPU
+        supports"""
+        levels = isa_levels()
+        if args.ISA.strip() != "matrix":
+            wanted = args.ISA.replace(",", " ").split()
+            unknown = set(wanted) - {level.name for level, _ in levels}
+            if unknown:
+                message = f"unknown ISA level(s) {', '.join(sorted(unknown))}"
+                self.print(message, dest=STDERR)
+                return error("BadOption", message)
+            levels = [(level, ok) for level, ok in levels if level.name in wanted]
+        variants = []
+        for level, supported in levels:
+            if supported:
+                variants.append(
+                    experiments.Variant(
+                        level.name, args.compiler, f"{args.cflags} {level.flag}"
+                    )
+                )
+            else:
+                # running it would only die with SIGILL
+                self.print(f"{level.name} is not supported by this CPU, skipping it")
+        if not variants:
+            return error("ExeFailed", "No supported ISA level to build")
+        results = await self.measure_variants(args, exe_env, variants, args.repeats)
+        timed = [result for result in results if result.time is not None]
+        if not timed:
+            return error("ExeFailed", "No variant built and ran")
+        reference = timed[0]
+        rows = []
+        for result in results:
+            flag = result.variant.cflags[len(args.cflags) :].strip()
+            row = [result.variant.label, flag, "", "", ""]
+            if result.build_time is None:
+                row[-1] = "build failed"
+            elif result.time is None:
+                row[-1] = "run failed"
+            else:
+                row[2:] = [
+                    result.time,
+                    reference.time / result.time,
+                    "same" if result.stdout == reference.stdout else "differs",
+                ]
+            rows.append(row)
+        title = f"ISA levels (relative to {reference.variant.label})"
+        headers = ["level", "flags", "time (s)", "speed-up", "output"]
+        self.display(report.table(headers, rows, title=title))
+        self.display(
+            report.bar_chart(
+                [result.variant.label for result in timed],
+                [reference.time / result.time for result in timed],
+                f"Speed-up over {reference.variant.label}",
+                unit="x",
+            )
+        )
         return success(self.execution_count)
 
+    async def build_in_directory(
+        self,
+        args: Namespace,
+        cflags: str,
+        directory: Path,
+        exe_name: str,
+        ldflags: str = "",
+    ) -> Optional[Path]:
+        """Compile the cell to an object in directory and link it as exe_name
+        there, returning the executable's path or None on failure"""
+        obj = directory / "cell.o"
+        exe = directory / exe_name
+        cflags = f"{args.exe_cflags} {cflags}"
+        compile_cmd = self.command_compile(
+            args.compiler, cflags, "", args.filename, obj
+        )
+        link_cmd = self.command_link_exe(
+            args.compiler,
+            f"{cflags} {args.exe_ldflags} {args.LDFLAGS} {ldflags}",
+            exe,
+            obj,
+            f"{self.ck_dyn_obj} {args.depends}",
+        )
+        for command in (compile_cmd, link_cmd):
+            self.log_info("%s", command)
+            result, _, stderr = await command.run_silent()
+            if result != 0:
+                self.print(f"failed to build the {exe_name} executable", dest=STDERR)
+                for line in stderr:
+                    self.print(line, dest=STDERR, end="")
+                return None
+        return exe
+
+    async def train_pgo(
+        self,
+        args: Namespace,
+        family: str,
+        directory: Path,
+        exe_args: str,
+        exe_env: Dict[str, str],
+        runs: int,
+    ) -> bool:
+        """Build the cell with instrumentation and run it to write a profile
+        to directory, returning whether that succeeded"""
+        for stale in [*directory.glob("*.profraw"), *directory.glob("*.gcda")]:
+            stale.unlink()
+        cflags = f"{args.cflags} {pgo.generate_flags(family)}"
+        instrumented = await self.build_in_directory(
+            args, cflags, directory, "instrumented"
+        )
+        if instrumented is None:
+            return False
+        env = dict(exe_env)
+        if family == "clang":
+            env["LLVM_PROFILE_FILE"] = str(directory / "%p.profraw")
+        command = self.command_run_exe(str(instrumented), exe_args, env, args.launcher)
+        self.print(f"$> {command}")
+        result, times, stdout = await self.benchmark(command, runs)
+        if result != 0:
+            self.print(f"training run failed with exit code {result}", dest=STDERR)
+            for line in stdout:
+                self.print(line, dest=STDERR, end="")
+            return False
+        self.print(f"trained with {runs} run(s) in {sum(times):.3f} s")
+        if family != "clang":
+            return True
+        llvm_profdata = find_program("llvm-profdata")
+        if llvm_profdata is None:
+            self.print("llvm-profdata was not found", dest=STDERR)
+            return False
+        raw = " ".join(str(path) for path in directory.glob("*.profraw"))
+        merge = AsyncCommand(
+            f"{llvm_profdata} merge -o {directory / 'merged.profdata'} {raw}",
+            logger=self.log,
+        )
+        self.log_info("%s", merge)
+        result, _, stderr = await merge.run_silent()
+        if result != 0:
+            self.print("failed to merge the profiles", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return False
+        return True
+
+    async def run_pgo(self, args: Namespace, exe_env: Dict[str, str]):
+        """Train the cell with an instrumented build, build it again with the
+        profile and compare its time with the cell's plain build. Profiles
+        are cached by the cell's source and flags."""
+        try:
+            options = pgo.parse_options(args.PGO)
+        except ValueError as exc:
+            self.print(str(exc), dest=STDERR)
+            return error("BadOption", str(exc))
+        family = await self.compiler_family(args.compiler)
+        with open(args.filename, encoding="utf-8") as src:
+            sources = [src.read()] + experiments.local_includes(args.filename)
+        directory = self.artifact_cache(args).path(
+            ".pgo", args.compiler, args.cflags, args.exe_cflags, args.depends, *sources
+        )
+        directory.mkdir(exist_ok=True)
+        exe_args = args.ARGS
+        if options.stdin:
+            exe_args = f"{exe_args} < {shlex.quote(options.stdin)}"
+
+        previous = self._pgo_profiles.get(args.filename)
+        if pgo.trained(family, directory, "cell.o"):
+            self.print("using the profile trained on this version of the cell")
+        else:
+            if previous is not None and previous != directory:
+                self.print(
+                    "the cell changed since it was trained, so its profile is "
+                    "stale: training again",
+                    dest=STDERR,
+                )
+            if not await self.train_pgo(
+                args, family, directory, exe_args, exe_env, options.runs
+            ):
+                return error("PGOFailed", "Failed to train a profile")
+        self._pgo_profiles[args.filename] = directory
+
+        optimised = await self.build_in_directory(
+            args, f"{args.cflags} {pgo.use_flags(family, directory)}", directory, "pgo"
+        )
+        baseline = await self.build_variant(
+            args, experiments.Variant("baseline", args.compiler, args.cflags)
+        )
+        if optimised is None or baseline is None:
+            return error("CompileFailed", "Compilation failed")
+        builds = [("baseline", baseline[0]), ("PGO", optimised)]
+        title = "Profile-guided optimisation"
+        return await self.compare_builds(args, exe_env, builds, exe_args, title)
+
+    async def compare_builds(
+        self,
+        args: Namespace,
+        exe_env: Dict[str, str],
+        builds: List[Tuple[str, Path]],
+        exe_args: str,
+        title: str,
+    ):
+        """Time each of the labelled executables in turn and show their speed-up
+        over the first"""
+        results = []
+        for label, exe in builds:
+            command = self.command_run_exe(str(exe), exe_args, exe_env, args.launcher)
+            timing = await self.time_exe(command, args.repeats)
+            if timing is None:
+                return error("ExeFailed", "Executable failed")
+            results.append((label, *timing))
+        (_, reference, expected), *_ = results
+        rows = [
+            [
+                label,
+                run_time,
+                reference / run_time,
+                "same" if stdout == expected else "differs",
+            ]
+            for label, run_time, stdout in results
+        ]
+        headers = ["build", "time (s)", "speed-up", "output"]
+        self.display(report.table(headers, rows, title))
+        return success(self.execution_count)
+
+    async def run_quietly(self, command: AsyncCommand, failure: str) -> bool:
+        "Run a command, reporting its stderr if it fails, and return whether it worked"
+        self.log_info("%s", command)
+        with self.active_command(command):
+            result, _, stderr = await command.run_silent()
+        if result != 0:
+            self.print(failure, dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+        return result == 0
+
+    async def collect_bolt_profile(
+        self, args: Namespace, exe_env: Dict[str, str], exe: Path, fdata: Path
+    ) -> Optional[str]:
+        """Profile exe for BOLT, sampling with perf if it's available and
+        otherwise with BOLT's own instrumentation. Return how the profile was
+        collected, or None on failure."""
+        perf, perf2bolt = shutil.which("perf"), find_program("perf2bolt")
+        if perf and perf2bolt and not args.launcher:
+            data = exe.parent / "perf.data"
+            for lbr in (True, False):
+                record = self.command_run_exe(
+                    str(exe), args.ARGS, exe_env, bolt.perf_record(perf, data, lbr)
+                )
+                self.log_info("%s", record)
+                result, *_ = await self.benchmark(record, 1)
+                if result != 0:
+                    continue
+                convert = AsyncCommand(
+                    bolt.perf2bolt(perf2bolt, exe, data, fdata, lbr), logger=self.log
+                )
+                failure = "failed to convert the perf profile"
+                if await self.run_quietly(convert, failure):
+                    return "perf with branch records" if lbr else "perf samples"
+            self.print("perf failed, using BOLT's instrumentation instead")
+        llvm_bolt = find_program("llvm-bolt")
+        instrumented = exe.parent / "instrumented"
+        command = AsyncCommand(
+            bolt.instrument(llvm_bolt, exe, instrumented, fdata), logger=self.log
+        )
+        if not await self.run_quietly(command, "failed to instrument the executable"):
+            return None
+        run = self.command_run_exe(str(instrumented), args.ARGS, exe_env, args.launcher)
+        self.print(f"$> {run}")
+        result, *_ = await self.benchmark(run, 1)
+        if result != 0 or not fdata.exists():
+            self.print("the instrumented executable failed", dest=STDERR)
+            return None
+        return "instrumentation"
+
+    async def run_bolt(self, args: Namespace, exe_env: Dict[str, str]):
+        """Relink the cell with relocations, profile it, optimise its layout
+        with llvm-bolt and compare the time of the two executables. Return
+        None if BOLT isn't available, so that the cell runs as usual."""
+        llvm_bolt = find_program("llvm-bolt")
+        if llvm_bolt is None:
+            self.print(
+                "llvm-bolt was not found, so the cell runs without BOLT", dest=STDERR
+            )
+            return None
+        with open(args.filename, encoding="utf-8") as src:
+            sources = [src.read()] + experiments.local_includes(args.filename)
+        directory = self.artifact_cache(args).path(
+            ".bolt", args.compiler, args.cflags, args.exe_cflags, args.depends, *sources
+        )
+        directory.mkdir(exist_ok=True)
+        exe = await self.build_in_directory(
+            args, args.cflags, directory, "relocs", ldflags=bolt.LINK_FLAGS
+        )
+        if exe is None:
+            return error("CompileFailed", "Compilation failed")
+        fdata = directory / "profile.fdata"
+        remove_file(str(fdata))
+        method = await self.collect_bolt_profile(args, exe_env, exe, fdata)
+        if method is None:
+            return error("BOLTFailed", "Failed to profile the executable")
+        self.print(f"profiled with {method}")
+        optimised = directory / "bolt"
+        command = AsyncCommand(
+            bolt.optimise(llvm_bolt, exe, optimised, fdata), logger=self.log
+        )
+        if not await self.run_quietly(command, "llvm-bolt failed"):
+            return error("BOLTFailed", "llvm-bolt failed")
+        builds = [("baseline", exe), ("BOLT", optimised)]
+        title = "BOLT layout optimisation"
+        return await self.compare_builds(args, exe_env, builds, args.ARGS, title)
+
+    async def report_generated_code(self, args: Namespace, binary: str):
+        """Show the reports on the cell's generated code requested by its
+        options. The binary is the cell's object or executable."""
+        if args.ASM:
+            await self.report_asm(args)
+        if args.ASMDIFF:
+            await self.report_asm_diff(args)
+        if args.REMARKS:
+            await self.report_remarks(args)
+        if args.mca:
+            await self.report_mca(args)
+        if args.LAYOUT:
+            await self.report_layout(args)
+        if args.compiletime:
+            await self.report_compile_time(args)
+        if args.size:
+            await self.report_size(args, binary)
+
+    async def disassemble(self, obj: str, source: str) -> List[assembly.Function]:
+        "Return the functions disassembled from an object, or [] on failure"
+        command = AsyncCommand(assembly.objdump_command(obj), logger=self.log)
+        self.log_info("%s", command)
+        result, stdout, stderr = await command.run_silent()
+        if result != 0:
+            self.print(f"failed to disassemble {obj}", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return []
+        return assembly.parse_objdump(stdout, source)
+
+    async def report_asm(self, args: Namespace):
+        "Show the disassembly of the functions named by ASM from the cell's object"
+        functions = await self.disassemble(args.obj, args.filename)
+        selected = []
+        for name in args.ASM.replace(",", " ").split():
+            found = [f for f in functions if assembly.matches(f.name, name)]
+            if not found:
+                available = ", ".join(f.name for f in functions)
+                self.print(f"no function {name} in {args.obj} (found: {available})")
+            selected.extend(f for f in found if f not in selected)
+        if selected:
+            with open(args.filename, encoding="utf-8") as src:
+                source_lines = src.readlines()
+            self.display(assembly.render(selected, source_lines))
+
+    async def report_asm_diff(self, args: Namespace):
+        """Compile the cell with each of the two flag sets (optionally preceded
+        by a compiler) given by ASMDIFF and compare their assembly function by
+        function"""
+        sides = shlex.split(args.ASMDIFF)
+        if len(sides) != 2:
+            self.print('expected ASMDIFF "flags" "flags"', dest=STDERR)
+            return
+        variants = []
+        for side in sides:
+            compiler, flags = args.compiler, side
+            first, _, rest = side.partition(" ")
+            if first and not first.startswith("-"):
+                compiler, flags = first, rest
+            variants.append(
+                experiments.Variant(side, compiler, f"{args.cflags} {flags}")
+            )
+        objs = await asyncio.gather(
+            *(self.compile_variant(args, variant) for variant in variants)
+        )
+        if None in objs:
+            return
+        before, after = [
+            {f.name: f for f in await self.disassemble(str(obj), args.filename)}
+            for obj in objs
+        ]
+        rows, changed = [], []
+        for name in [*before, *(name for name in after if name not in before)]:
+            stats = [
+                assembly.statistics(functions[name]) if name in functions else {}
+                for functions in (before, after)
+            ]
+            if not stats[1]:
+                status = f"only with {sides[0]}"
+            elif not stats[0]:
+                status = f"only with {sides[1]}"
+            elif assembly.normalise(before[name]) == assembly.normalise(after[name]):
+                status = "same"
+            else:
+                status = "changed"
+                changed.append(name)
+            row = [name]
+            for key in ("instructions", "vector", "widest", "back_edges"):
+                row.extend(side.get(key, "") for side in stats)
+            rows.append([*row, status])
+        headers = ["function"]
+        for key in ("instrs", "vector", "widest (bits)", "back-edges"):
+            headers.extend([f"{key} A", f"{key} B"])
+        title = f"Assembly: A = {sides[0]}, B = {sides[1]}"
+        self.display(report.table([*headers, "status"], rows, title=title))
+        for name in changed:
+            self.display(assembly.diff(before[name], after[name], sides))
+
+    async def demangle(self, names: List[str]) -> Dict[str, str]:
+        "Return the demangled form of each symbol name"
+        mangled = [name for name in names if name.startswith("_Z")]
+        demangled = {name: name for name in names}
+        if mangled:
+            command = AsyncCommand(f"c++filt {' '.join(mangled)}", logger=self.log)
+            result, stdout, _ = await command.run_silent()
+            if result == 0 and len(stdout) == len(mangled):
+                demangled.update(zip(mangled, (line.strip() for line in stdout)))
+        return demangled
+
+    async def report_mca(self, args: Namespace):
+        """Predict the throughput of the cell's marked regions and the loops of
+        its named functions with llvm-mca"""
+        llvm_mca = find_program("llvm-mca")
+        if llvm_mca is None:
+            self.print("llvm-mca was not found", dest=STDERR)
+            return
+        with open(args.filename, encoding="utf-8") as src:
+            source_lines = src.readlines()
+        words = args.MCA.replace(",", " ").split()
+        names = [word for word in words if not word.startswith("-")]
+        mca_flags = " ".join(word for word in words if word.startswith("-"))
+
+        listing_file = self.twd / "mca.s"
+        command = AsyncCommand(
+            f"{args.compiler} {args.cflags} -g -S {args.filename} -o {listing_file}",
+            logger=self.log,
+        )
+        self.log_info("%s", command)
+        result, _, stderr = await command.run_silent()
+        if result != 0:
+            self.print("failed to compile the cell to assembly", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return
+        with open(listing_file, encoding="utf-8") as listing_src:
+            listing = assembly.parse_listing(listing_src.readlines(), args.filename)
+
+        selections = [
+            (name, assembly.from_lines(first, last))
+            for name, first, last in assembly.marked_regions(source_lines)
+        ]
+        functions = sorted({ins.function for ins in listing.instructions})
+        demangled = await self.demangle(functions)
+        for name in names:
+            found = {f for f in functions if assembly.matches(demangled[f], name)}
+            if not found:
+                self.print(f"no function {name} in the cell", dest=STDERR)
+            else:
+                selections.append((name, lambda ins, f=found: ins.function in f))
+        regions, without_loops = assembly.mca_regions(listing, selections)
+        for name in without_loops:
+            self.print(f"no loop found in {name}, so it isn't analysed", dest=STDERR)
+        if not regions and not without_loops:
+            self.print(
+                "nothing to analyse: mark a region with // ckernel:mca-begin and "
+                "// ckernel:mca-end or name a function with MCA",
+                dest=STDERR,
+            )
+            return
+        if not regions:
+            return
+
+        comment = "//" if platform.machine().lower() in ("aarch64", "arm64") else "#"
+        mca_file = self.twd / "mca_regions.s"
+        with open(mca_file, "w", encoding="utf-8") as mca_src:
+            mca_src.write(assembly.mca_input(regions, comment))
+        command = AsyncCommand(
+            f"{llvm_mca} -bottleneck-analysis {mca_flags} {mca_file}", logger=self.log
+        )
+        self.log_info("%s", command)
+        result, stdout, stderr = await command.run_silent()
+        if result != 0:
+            self.print("llvm-mca failed", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return
+        rows = []
+        analysed = assembly.parse_mca("".join(stdout))
+        for region in analysed:
+            summary = region.summary
+            busiest = max(region.pressure, key=region.pressure.get, default="")
+            rows.append(
+                [
+                    region.name,
+                    int(summary["Instructions"] / max(summary["Iterations"], 1)),
+                    summary.get("Block RThroughput", ""),
+                    summary.get("IPC", ""),
+                    summary.get("uOps Per Cycle", ""),
+                    f"{busiest} ({region.pressure[busiest]:.2f})" if busiest else "",
+                    region.bottleneck,
+                ]
+            )
+        headers = ["region", "instrs", "block rthroughput", "IPC", "uops/cycle"]
+        headers.extend(["busiest resource", "bottlenecks"])
+        self.display(report.table(headers, rows, title="llvm-mca analysis"))
+        for region in analysed:
+            used = {name: value for name, value in region.pressure.items() if value}
+            self.display(
+                report.bar_chart(
+                    list(used),
+                    list(used.values()),
+                    f"{region.name}: resource pressure per iteration",
+                    unit="cycles",
+                )
+            )
+
+    async def compiler_family(self, compiler: str) -> str:
+        "Return 'clang' or 'gcc' according to the compiler's --version banner"
+        if compiler not in self._compiler_families:
+            command = AsyncCommand(f"{compiler} --version", logger=self.log)
+            _, stdout, _ = await command.run_silent()
+            banner = "".join(stdout).lower()
+            self._compiler_families[compiler] = "clang" if "clang" in banner else "gcc"
+        return self._compiler_families[compiler]
+
+    async def report_remarks(self, args: Namespace):
+        """Compile the cell again with optimisation remarks enabled and show
+        them alongside its source"""
+        try:
+            categories = remarks.parse_categories(args.REMARKS)
+        except ValueError as exc:
+            self.print(str(exc), dest=STDERR)
+            return
+        family = await self.compiler_family(args.compiler)
+        record = self.twd / ("remarks.yaml" if family == "clang" else "remarks.txt")
+        remove_file(str(record))
+        command = self.command_compile(
+            args.compiler,
+            f"{args.cflags} {remarks.flags(family, str(record))}",
+            "",
+            args.filename,
+            self.twd / "remarks.o",
+        )
+        self.log_info("%s", command)
+        result, _, stderr = await command.run_silent()
+        if result != 0 or not record.exists():
+            self.print("failed to collect optimisation remarks", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return
+        with open(record, encoding="utf-8") as records:
+            if family == "clang":
+                found = remarks.parse_clang(records.read(), args.filename)
+            else:
+                found = remarks.parse_gcc(records, args.filename)
+        with open(args.filename, encoding="utf-8") as src:
+            source_lines = src.readlines()
+        self.display(remarks.render(found, source_lines, categories))
+
+    async def report_layout(self, args: Namespace):
+        """Show the layout of the types named by LAYOUT, read from the debug
+        info in the cell's object"""
+        command = AsyncCommand(f"readelf --debug-dump=info {args.obj}", logger=self.log)
+        self.log_info("%s", command)
+        result, stdout, stderr = await command.run_silent()
+        if result != 0:
+            self.print(f"failed to read debug info from {args.obj}", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return
+        types = dwarf.TypeInfo(dwarf.parse_dies(stdout))
+        layouts = []
+        for name in args.LAYOUT.replace(",", " ").split():
+            layout = types.layout(name)
+            if layout is None:
+                self.print(
+                    f"no struct, class or union {name} in {args.obj} "
+                    "(types are only described if the cell uses them)"
+                )
+            else:
+                layouts.append(layout)
+        if layouts:
+            self.display(dwarf.render(layouts))
+
+    async def measure_size(self, binary: str) -> Optional[codesize.Sizes]:
+        "Return the sizes of the sections and symbols of an object or executable"
+        readelf = AsyncCommand(f"readelf -S -W {binary}", logger=self.log)
+        nm = AsyncCommand(
+            f"nm --print-size --demangle --radix=d {binary}", logger=self.log
+        )
+        nm_kernel = AsyncCommand(f"nm --demangle {self.ck_dyn_obj}", logger=self.log)
+        results = []
+        for command in (readelf, nm, nm_kernel):
+            self.log_info("%s", command)
+            result, stdout, stderr = await command.run_silent()
+            if result != 0:
+                self.print(f"failed to measure the size of {binary}", dest=STDERR)
+                for line in stderr:
+                    self.print(line, dest=STDERR, end="")
+                return None
+            results.append(stdout)
+        sections_out, symbols_out, kernel_out = results
+        # leave out the kernel's input wrappers linked into executables
+        kernel_symbols = {line.rstrip("\n").split(" ", 2)[-1] for line in kernel_out}
+        symbols = [
+            symbol
+            for symbol in codesize.parse_symbols(symbols_out)
+            if symbol.name not in kernel_symbols
+        ]
+        return codesize.Sizes(codesize.parse_sections(sections_out), symbols)
+
+    async def report_size(self, args: Namespace, binary: str):
+        """Show the size of the sections, largest symbols and largest template
+        instantiations of the cell's object or executable, and how they
+        changed since the cell was last built"""
+        sizes = await self.measure_size(binary)
+        if sizes is None:
+            return
+        previous = self._sizes.get(args.filename)
+        self._sizes[args.filename] = sizes
+        before: Dict[str, int] = {}
+        if previous is not None:
+            before = {s.name: s.size for s in previous.sections + previous.symbols}
+
+        def row(name: str, kind: str, size: int) -> list:
+            if previous is None:
+                return [codesize.shorten(name), kind, size, ""]
+            change = codesize.change(size, before.get(name, 0))
+            return [codesize.shorten(name), kind, size, change]
+
+        rows = [row(s.name, s.flags, s.size) for s in sizes.sections]
+        rows.append(["total", "", sizes.total, ""])
+        if previous is not None:
+            rows[-1][-1] = codesize.change(sizes.total, previous.total)
+        title = f"Size of {binary}"
+        self.display(report.table(["section", "flags", "bytes", "change"], rows, title))
+
+        limit = self._default_size_rows
+        rows = [row(s.name, s.kind, s.size) for s in sizes.symbols[:limit]]
+        if previous is not None:
+            # show the symbols which went away too
+            current = {s.name for s in sizes.symbols}
+            gone = [s for s in previous.symbols if s.name not in current]
+            rows.extend(
+                [codesize.shorten(s.name), s.kind, 0, f"{-s.size:+d}"]
+                for s in gone[:limit]
+            )
+        self.display(
+            report.table(["symbol", "type", "bytes", "change"], rows, "Largest symbols")
+        )
+
+        rows = [
+            [codesize.shorten(t.name), t.instantiations, t.size]
+            for t in codesize.templates(sizes.symbols)[:limit]
+        ]
+        if rows:
+            headers = ["template", "instantiations", "bytes"]
+            title = "Code size of template instantiations"
+            self.display(report.table(headers, rows, title))
+
+    async def time_headers(self, args: Namespace, headers: List[str]):
+        """Time parsing each header on its own, less the time to parse an
+        empty file. Headers included by several are counted for each."""
+        source = self.twd / f"header{os.path.splitext(args.filename)[1]}"
+        cflags = f"{args.cflags} -I{os.getcwd()} -fsyntax-only"
+        times = []
+        for header in [""] + headers:
+            with open(source, "w", encoding="utf-8") as src:
+                src.write(f"#include {header}\n" if header else "\n")
+            command = self.command_compile(
+                args.compiler, cflags, "", source, self.twd / "header.o"
+            )
+            self.log_info("%s", command)
+            start = time.perf_counter()
+            result, *_ = await command.run_silent()
+            elapsed = time.perf_counter() - start
+            if result == 0:
+                times.append(compiletime.Entry(header, elapsed))
+        if not times or times[0].name != "":
+            return []
+        baseline = times[0].seconds
+        return compiletime.by_time(
+            {entry.name: max(entry.seconds - baseline, 0.0) for entry in times[1:]}
+        )
+
+    async def report_compile_time(self, args: Namespace):
+        """Compile the cell again with the compiler's time report and show
+        where the time went: per phase, per header and per template"""
+        family = await self.compiler_family(args.compiler)
+        obj = self.twd / "compiletime.o"
+        trace = self.twd / "compiletime.json"
+        remove_file(str(trace))
+        flag = "-ftime-trace" if family == "clang" else "-ftime-report"
+        command = self.command_compile(
+            args.compiler, f"{args.cflags} {flag}", "", args.filename, obj
+        )
+        self.log_info("%s", command)
+        start = time.perf_counter()
+        result, _, stderr = await command.run_silent()
+        elapsed = time.perf_counter() - start
+        if result != 0 or (family == "clang" and not trace.exists()):
+            self.print("failed to profile the compilation", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return
+        if family == "clang":
+            with open(trace, encoding="utf-8") as trace_src:
+                profile = compiletime.parse_clang(trace_src.read())
+        else:
+            with open(args.filename, encoding="utf-8") as src:
+                headers = compiletime.includes(src)
+            profile = compiletime.parse_gcc(
+                stderr, await self.time_headers(args, headers)
+            )
+        self.print(f"compiled in {elapsed:.3f} s")
+        total = profile.total or 1.0
+        for title, entries in (
+            ("Time per phase", profile.phases),
+            ("Time per compiler pass", profile.passes),
+            ("Time per header", profile.headers),
+            ("Time per template instantiation", profile.templates),
+        ):
+            rows = [
+                [entry.name, entry.seconds, f"{100 * entry.seconds / total:.1f}%"]
+                for entry in entries[: self._default_compiletime_rows]
+                if entry.seconds > 0
+            ]
+            if rows:
+                self.display(report.table(["name", "time (s)", "share"], rows, title))
+        if profile.frames:
+            self.display(report.flame_graph(profile.frames, "Compile time"))
+
+    async def build_shim(
+        self, source: str, compiler: Optional[str] = None
+    ) -> Optional[Path]:
+        """Compile the named resource to a shared library for preloading, or
+        return the previously compiled library"""
+        if source in self._shims:
+            return self._shims[source]
+        src = resource.get(source)
+        lib = self.twd / f"lib{src.stem}.so"
+        compiler = compiler or self.env.CKERNEL_CC
+        compile_cmd = AsyncCommand(
+            f"{compiler} -O2 -fPIC -shared {src} -o {lib} -ldl -lpthread",
+            logger=self.log,
+        )
+        self.log_info("%s", compile_cmd)
+        result, _, stderr = await compile_cmd.run_silent()
+        if result != 0:
+            self.print(f"failed to compile {src.name}", dest=STDERR)
+            for line in stderr:
+                self.print(line, dest=STDERR, end="")
+            return None
+        self._shims[source] = lib
+        return lib
+
+    def ckernel_magic(self, line: str):
+        """The %ckernel line magic:
+
+        %ckernel profile            list the build profiles
+        %ckernel profile NAME       build cells with the named profile
+        %ckernel profile none       build cells with their own flags only
+        %ckernel export-build DIR   write the cells and their builds to DIR
+        """
+        command, *words = line.split() or [""]
+        if command == "export-build" and len(words) == 1:
+            self.export_build(words[0])
+            return
+        if command != "profile" or len(words) > 1:
+            self.print(f"usage: {self.ckernel_magic.__doc__}", dest=STDERR)
+            return
+        if words and words[0] == "none":
+            self.profile = ""
+        elif words and words[0] not in self.profiles:
+            available = ", ".join(self.profiles)
+            self.print(f"unknown profile {words[0]} (found: {available})", dest=STDERR)
+            return
+        elif words:
+            self.profile = words[0]
+        for profile in self.profiles.values():
+            marker = "*" if profile.name == self.profile else " "
+            self.print(f"{marker} {profile.describe()}")
+        if not self.profile:
+            self.print("(no profile: cells are built with their own flags only)")
+
+    def export_build(self, directory: str):
+        """Copy the sources of the cells built in the session, and their local
+        headers, to a directory with a build.ninja and a CMakeLists.txt which
+        build the cells with the commands the kernel ran. The input wrappers
+        and files in the kernel's working directory, such as the sources of
+        UNITY builds, are copied to the top of the directory."""
+        root = Path(directory)
+        root.mkdir(parents=True, exist_ok=True)
+        cwd = os.getcwd()
+
+        def path(name: str) -> str:
+            file = Path(name)
+            if not file.is_absolute():
+                return name
+            if file == resource.input_wrappers_src:
+                return file.name
+            if self.twd in file.parents:
+                return "-".join(file.relative_to(self.twd).parts)
+            if Path(cwd) in file.parents:
+                return str(file.relative_to(cwd))
+            return name
+
+        steps = [export.relocate(step, path) for step in self._builds.values()]
+        outputs = {step.output for step in self._builds.values()}
+        sources = [
+            name
+            for step in self._builds.values()
+            for name in step.inputs
+            if name not in outputs
+        ]
+        for source in dict.fromkeys(sources):
+            if not os.path.isfile(source):
+                self.print(f"{source} no longer exists, so isn't exported", STDERR)
+                continue
+            for name in [source] + export.headers(source):
+                target = path(os.path.abspath(name))
+                if os.path.isabs(target):
+                    continue  # not part of the session, e.g. a system header
+                (root / target).parent.mkdir(parents=True, exist_ok=True)
+                shutil.copyfile(name, root / target)
+        (root / "build.ninja").write_text(export.ninja(steps, cwd), encoding="utf-8")
+        (root / "CMakeLists.txt").write_text(
+            export.cmake(steps, root.resolve().name, cwd), encoding="utf-8"
+        )
+        programs = sum(not step.compile_only for step in steps)
+        self.print(
+            f"exported {len(steps) - programs} objects and {programs} programs "
+            f"to {root}: build with ninja -C {root} or cmake -S {root} -B BUILD"
+        )
+
     def parse_args(self, code: str) -> Namespace:
         args = self.default_compiler_args()
         header, *lines = code.splitlines()
@@ -311,14 +2209,60 @@ class AutoCompileKernel(BaseKernel):
                     args.should_exec = False
                 elif opt == "NOCOMPILE":
                     args.should_compile = False
+                elif opt == "HUGEPAGES":
+                    args.hugepages = True
+                elif opt == "PTHREAD_TRACE":
+                    args.pthread_trace = True
+                elif opt == "OMP_PROFILE":
+                    args.omp_profile = True
+                elif opt == "MPI_PROFILE":
+                    args.mpi_profile = True
+                elif opt == "COMPILETIME":
+                    args.compiletime = True
+                elif opt == "SIZE":
+                    args.size = True
+                elif opt == "BOLT":
+                    args.bolt = True
+                elif opt == "UNITY":
+                    args.unity = True
+                elif opt == "BENCHMARK":
+                    args.BENCHMARK = rest or str(self._default_repeats)
+                elif opt == "MPI":
+                    args.MPI = rest or str(self._default_ranks)
+                elif opt == "AUTOTUNE":
+                    args.AUTOTUNE = rest or f"budget={self._default_autotune_budget}"
+                elif opt == "PGO":
+                    args.PGO = rest or "runs=1"
+                elif opt == "LTO":
+                    args.LTO = rest or "full"
+                elif opt == "REMARKS":
+                    args.REMARKS = rest or ",".join(remarks.DEFAULT_CATEGORIES)
                 else:
                     setattr(args, opt, rest)
 
+        # Detect an MPI launch, e.g. "MPI 4 split", or "MPI split" with the
+        # default number of ranks:
+        args.ranks = self._default_ranks if args.MPI else 0
+        args.split_ranks = False
+        for word in args.MPI.split():
+            if word == "split":
+                args.split_ranks = True
+            elif word.isdigit() and int(word) > 0:
+                args.ranks = int(word)
+            else:
+                self.print(
+                    f"MPI expects a number of ranks or split, not {word}", STDERR
+                )
+
         # Set the compiler
         if args.language is None:
             args.compiler = None
+        elif args.language == Lang.C and args.ranks > 0:
+            args.compiler = args.CC or self.env.CKERNEL_MPICC or "mpicc"
         elif args.language == Lang.C:
             args.compiler = args.CC or self.env.CKERNEL_CC
+        elif args.language == Lang.CPP and args.ranks > 0:
+            args.compiler = args.CXX or self.env.CKERNEL_MPICXX or "mpicxx"
         elif args.language == Lang.CPP:
             args.compiler = args.CXX or self.env.CKERNEL_CXX
         else:
@@ -330,9 +2274,55 @@ class AutoCompileKernel(BaseKernel):
         else:
             args.cflags = args.CXXFLAGS
 
+        # Set the extra flags for compiling/linking executables:
+        if args.language == Lang.C:
+            args.exe_cflags = self.env.CKERNEL_EXE_CFLAGS or ""
+        elif args.language == Lang.CPP:
+            args.exe_cflags = self.env.CKERNEL_EXE_CXXFLAGS or ""
+        else:
+            args.exe_cflags = ""
+        args.exe_ldflags = self.env.CKERNEL_EXE_LDFLAGS or ""
+
+        # The build profile's flags are added by apply_profile:
+        args.profile = args.PROFILE_BUILD.strip() or self.profile
+        if args.profile and args.profile not in self.profiles:
+            self.print(f"unknown build profile {args.profile}", STDERR)
+            args.profile = ""
+
+        # Analyse marked regions with llvm-mca even without the MCA option:
+        args.mca = bool(args.MCA) or "ckernel:mca-begin" in code
+
+        # Debug info lets the disassembly refer to source lines and describes
+        # the layout of types. It doesn't change the generated code.
+        if (args.ASM or args.LAYOUT) and "-g" not in args.cflags.split():
+            args.cflags = f"{args.cflags} -g".strip()
+
+        # Build specialised variants over these macros, using the first value
+        # of each for the cell's own build:
+        try:
+            args.specialize = experiments.parse_parameters(args.SPECIALIZE)
+        except ValueError as err:
+            self.print(f"SPECIALIZE {err}", STDERR)
+            args.specialize = {}
+        args.base_cflags = args.cflags
+        args.cflags = " ".join(
+            [args.cflags]
+            + [f"-D{name}={values[0]}" for name, values in args.specialize.items()]
+        ).strip()
+
         # Set the .o dependencies:
         args.depends = args.DEPENDS
 
+        # Set the number of timed runs:
+        args.repeats = 0
+        if args.BENCHMARK.strip().isdigit() and int(args.BENCHMARK) > 0:
+            args.repeats = int(args.BENCHMARK)
+        elif args.BENCHMARK:
+            self.print(
+                f"BENCHMARK expects a number of runs, not {args.BENCHMARK.strip()}",
+                STDERR,
+            )
+
         return args
 
     def command_compile(
@@ -356,15 +2346,6 @@ class AutoCompileKernel(BaseKernel):
     ) -> AsyncCommand:
         return AsyncCommand(f"{compiler} {cflags} {name} {depends} {ldflags} -o {exe}")
 
-    def command_detect_main(self, objfile: str) -> AsyncCommand:
-        if is_macOS:
-            # it seems that on macOS `int main()` is compiled to the symbol
-            # `_main`
-            cmd = f"""nm {objfile} | grep " T _main" """
-        else:
-            cmd = f"""nm {objfile} | grep " T main" """
-        return AsyncCommand(cmd)
-
     def command_link_exe(
         self, compiler: str, ldflags: str, exe: str, objname: str, depends: str
     ) -> AsyncCommand:
@@ -376,6 +2357,14 @@ class AutoCompileKernel(BaseKernel):
         extra = extra or []
         args = Namespace(**{opt: "" for opt in (cls._known_opts + extra)})
         args.verbose = False
+        args.hugepages = False
+        args.pthread_trace = False
+        args.omp_profile = False
+        args.mpi_profile = False
+        args.compiletime = False
+        args.size = False
+        args.bolt = False
+        args.unity = False
         return args
 
     @property
@@ -130,6 +130,17 @@ class BaseKernel(IPythonKernel):
             self.iopub_socket, "stream", {"name": dest, "text": text + end}
         )
 
+    def display(
+        self, data: dict[str, str], display_id: str = "", update: bool = False
+    ):
+        """Display a mime bundle in the notebook. If update is True, replace
+        the earlier output with the same display_id."""
+        content = {"data": data, "metadata": {}, "transient": {}}
+        if display_id:
+            content["transient"]["display_id"] = display_id
+        msg_type = "update_display_data" if update else "display_data"
+        self.send_response(self.iopub_socket, msg_type, content)
+
     def debug_msg(self, text: str):
         if self.debug:
             self.print(f"[DEBUG] {text}", dest=STDERR)
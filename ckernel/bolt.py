@@ -0,0 +1,39 @@
+"""Optimise the layout of a linked executable with BOLT"""
+from __future__ import annotations
+
+from pathlib import Path
+
+# Link flags which keep the relocations BOLT needs to move code
+LINK_FLAGS = "-Wl,--emit-relocs"
+
+# Reorder basic blocks and functions and split cold code out of hot functions
+OPTIMISE_FLAGS = (
+    "-reorder-blocks=ext-tsp -reorder-functions=hfsort -split-functions "
+    "-split-all-cold -icf=1 -use-gnu-stack"
+)
+
+
+def perf_record(perf: str, data: Path, lbr: bool) -> str:
+    """Return the perf command to sample a program (which follows it), with
+    branch records if the CPU has them"""
+    branches = "-j any,u " if lbr else ""
+    return f"{perf} record -e cycles:u {branches}-o {data} --"
+
+
+def perf2bolt(program: str, exe: Path, data: Path, fdata: Path, lbr: bool) -> str:
+    "Return the command to convert a perf profile of exe for BOLT"
+    no_lbr = "" if lbr else " -nl"
+    return f"{program} {exe} -p {data} -o {fdata}{no_lbr}"
+
+
+def instrument(llvm_bolt: str, exe: Path, instrumented: Path, fdata: Path) -> str:
+    "Return the command to instrument exe so that running it writes fdata"
+    return (
+        f"{llvm_bolt} {exe} -instrument -o {instrumented} "
+        f"--instrumentation-file={fdata}"
+    )
+
+
+def optimise(llvm_bolt: str, exe: Path, optimised: Path, fdata: Path) -> str:
+    "Return the command to optimise exe with the profile in fdata"
+    return f"{llvm_bolt} {exe} -o {optimised} -data={fdata} {OPTIMISE_FLAGS}"
@@ -0,0 +1,32 @@
+"""Store build artifacts by the inputs which produced them"""
+from __future__ import annotations
+
+import hashlib
+from pathlib import Path
+
+
+class ArtifactCache:
+    """A directory of artifacts named by a hash of the inputs which produced
+    them, so that an artifact can be reused when its inputs are unchanged"""
+
+    def __init__(self, root: Path) -> None:
+        self.root = root
+        self.root.mkdir(parents=True, exist_ok=True)
+
+    def __repr__(self) -> str:
+        return f"{self.__class__.__name__}({self.root})"
+
+    def path(self, suffix: str, *inputs: str) -> Path:
+        "Return the path of the artifact with the given suffix and inputs"
+        digest = hashlib.sha256("\0".join(inputs).encode()).hexdigest()[:16]
+        return self.root / f"{digest}{suffix}"
+
+
+def file_digest(path: str) -> str:
+    """Return a digest of a file's contents, so that an artifact built from the
+    file is named by them, or "" if there is no such file"""
+    try:
+        with open(path, "rb") as src:
+            return hashlib.sha256(src.read()).hexdigest()
+    except OSError:
+        return ""
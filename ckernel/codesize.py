@@ -0,0 +1,126 @@
+"""Measure the size of the sections and symbols of an object or executable"""
+from __future__ import annotations
+
+import re
+from typing import Dict, Iterable, List, NamedTuple, Optional
+
+# Operators whose names contain angle brackets, replaced while collapsing
+# template arguments
+_operators = ["operator<=>", "operator<<=", "operator<<", "operator<=", "operator<"]
+
+# Matches a clone suffix, e.g. " [clone .isra.0]"
+_clone = re.compile(r"( \[clone [^\]]*\])+$")
+
+
+class Section(NamedTuple):
+    name: str
+    size: int
+    flags: str
+
+
+class Symbol(NamedTuple):
+    name: str
+    kind: str  # nm's symbol type, e.g. "T" for code
+    size: int
+
+
+class Sizes(NamedTuple):
+    sections: List[Section]
+    symbols: List[Symbol]
+
+    def section(self, name: str) -> int:
+        return sum(s.size for s in self.sections if s.name == name)
+
+    @property
+    def total(self) -> int:
+        return sum(s.size for s in self.sections)
+
+
+class Template(NamedTuple):
+    name: str
+    instantiations: int
+    size: int
+
+
+def parse_sections(lines: Iterable[str]) -> List[Section]:
+    "Parse the allocated sections from the output of readelf -S -W"
+    sections = []
+    for line in lines:
+        if not line.lstrip().startswith("[") or "]" not in line:
+            continue
+        fields = line.split("]", 1)[1].split()
+        if len(fields) < 9 or fields[1] in ("NULL", "Type"):
+            continue
+        # the flags are absent for sections which have none
+        flags = fields[6] if len(fields) == 10 else ""
+        if "A" in flags:
+            sections.append(Section(fields[0], int(fields[4], 16), flags))
+    return sections
+
+
+def parse_symbols(lines: Iterable[str]) -> List[Symbol]:
+    """Parse the output of nm --print-size --demangle --radix=d into symbols,
+    largest first"""
+    symbols = []
+    for line in lines:
+        fields = line.rstrip("\n").split(" ", 3)
+        if len(fields) == 4 and fields[1].isdigit():
+            symbols.append(Symbol(fields[3], fields[2], int(fields[1])))
+    return sorted(symbols, key=lambda s: -s.size)
+
+
+def template_name(symbol: str) -> Optional[str]:
+    """Return the template a demangled symbol instantiates with its template
+    arguments, parameters and return type removed, e.g.
+    'std::vector<>::push_back', or None if it isn't a template"""
+    name = _clone.sub("", symbol)
+    for k, operator in enumerate(_operators):
+        name = name.replace(operator, f"operator@{k}@")
+    collapsed, depth = [], 0
+    for char in name:
+        if char == "<":
+            if depth == 0:
+                collapsed.append("<>")
+            depth += 1
+        elif char == ">" and depth > 0:
+            depth -= 1
+        elif depth == 0:
+            collapsed.append(char)
+    if "<>" not in collapsed:
+        return None
+    name = "".join(collapsed).replace("operator()", "operator@call@")
+    name = re.sub(r"\(.*\)( const)?( &&?)?$", "", name)
+    name = name.replace(" <>", "<>")
+    name = name.rsplit(" ", 1)[-1]
+    for k, operator in enumerate(_operators):
+        name = name.replace(f"operator@{k}@", operator)
+    return name.replace("operator@call@", "operator()")
+
+
+def templates(symbols: Iterable[Symbol]) -> List[Template]:
+    "Return the templates whose instantiations take up the most code, largest first"
+    totals: Dict[str, List[int]] = {}
+    for symbol in symbols:
+        if symbol.kind.upper() not in "TW":
+            continue
+        name = template_name(symbol.name)
+        if name is not None:
+            count_size = totals.setdefault(name, [0, 0])
+            count_size[0] += 1
+            count_size[1] += symbol.size
+    return sorted(
+        (Template(name, count, size) for name, (count, size) in totals.items()),
+        key=lambda t: -t.size,
+    )
+
+
+def shorten(name: str, length: int = 100) -> str:
+    "Shorten a long symbol name for display"
+    return name if len(name) <= length else name[: length - 3] + "..."
+
+
+def change(now: int, before: Optional[int]) -> str:
+    "Format the change in a size, or '' if there is nothing to compare with"
+    if before is None:
+        return ""
+    return f"{now - before:+d}" if now != before else "0"
@@ -0,0 +1,135 @@
+"""Parse compile-time profiles from GCC's -ftime-report and Clang's -ftime-trace"""
+from __future__ import annotations
+
+import json
+import re
+from typing import Dict, Iterable, List, NamedTuple, Tuple
+
+# Matches a line of -ftime-report, e.g.
+# " phase parsing   :   0.49 ( 53%)   0.29 ( 72%)   0.81 ( 58%)    39M ( 69%)"
+# capturing the name and wall time
+_gcc_timer = re.compile(
+    r"^ (\|?[^:]+?)\s*:\s+[\d.]+ \(\s*\d+%\)\s+[\d.]+ \(\s*\d+%\)\s+([\d.]+) \("
+)
+
+# Matches the last line of -ftime-report, e.g. " TOTAL   :   0.93   0.40   1.39   58M"
+_gcc_total = re.compile(r"^ TOTAL\s*:\s+[\d.]+\s+[\d.]+\s+([\d.]+)")
+
+# Matches an #include directive, capturing the delimiters and the header
+_include = re.compile(r'^\s*#\s*include\s*([<"])([^>"]+)[>"]')
+
+# GCC's timers which belong to the parsing phase. Every other pass is part
+# of optimisation and code generation.
+_gcc_parsing = ("preprocessing", "parser", "template", "name lookup", "overload")
+
+# Names of the events in a -ftime-trace which instantiate templates
+_clang_instantiations = ("InstantiateClass", "InstantiateFunction")
+
+
+class Entry(NamedTuple):
+    name: str
+    seconds: float
+
+
+# A frame of a flame graph: depth, start and duration (in seconds) and label
+Frame = Tuple[int, float, float, str]
+
+
+class Profile(NamedTuple):
+    total: float
+    phases: List[Entry]
+    passes: List[Entry]
+    headers: List[Entry]
+    templates: List[Entry]
+    frames: List[Frame]
+
+
+def includes(lines: Iterable[str]) -> List[str]:
+    "Return the #include directives of a source, e.g. ['<vector>', '\"a.h\"']"
+    found = []
+    for line in lines:
+        if match := _include.match(line):
+            delimiter, header = match.groups()
+            closing = ">" if delimiter == "<" else '"'
+            found.append(f"{delimiter}{header}{closing}")
+    return found
+
+
+def by_time(totals: Dict[str, float]) -> List[Entry]:
+    "Return entries sorted by decreasing time"
+    return sorted((Entry(k, v) for k, v in totals.items()), key=lambda e: -e.seconds)
+
+
+def parse_gcc(lines: Iterable[str], headers: List[Entry]) -> Profile:
+    """Parse the report of -ftime-report. GCC doesn't time headers, so
+    headers timed separately are given. Nor does it time templates one by
+    one, so the only template entry is the total time spent instantiating."""
+    total = 0.0
+    phases: Dict[str, float] = {}
+    passes: Dict[str, float] = {}
+    for line in lines:
+        if match := _gcc_total.match(line):
+            total = float(match.group(1))
+        elif match := _gcc_timer.match(line):
+            name, seconds = match.group(1).lstrip("|"), float(match.group(2))
+            if name.startswith("phase "):
+                phases[name[6:]] = seconds
+            else:
+                passes[name] = passes.get(name, 0.0) + seconds
+    templates = [Entry("(all templates)", passes.get("template instantiation", 0.0))]
+
+    # lay the phases end to end with their passes beneath them, scaled to fit
+    frames: List[Frame] = [(0, 0.0, total, "total")]
+    start = 0.0
+    for phase, seconds in phases.items():
+        frames.append((1, start, seconds, phase))
+        if phase in ("parsing", "opt and generate"):
+            parsing = phase == "parsing"
+            children = [
+                (name, t)
+                for name, t in passes.items()
+                if name.startswith(_gcc_parsing) == parsing and t > 0
+            ]
+            scale = min(1.0, seconds / (sum(t for _, t in children) or 1))
+            offset = start
+            for name, t in sorted(children, key=lambda c: -c[1]):
+                frames.append((2, offset, t * scale, name))
+                offset += t * scale
+        start += seconds
+    return Profile(total, by_time(phases), by_time(passes), headers, templates, frames)
+
+
+def parse_clang(text: str) -> Profile:
+    """Parse a -ftime-trace, summing the time spent in each header (including
+    the headers it includes) and in each template instantiation"""
+    events = [e for e in json.loads(text).get("traceEvents", []) if e.get("ph") == "X"]
+    phases: Dict[str, float] = {}
+    headers: Dict[str, float] = {}
+    templates: Dict[str, float] = {}
+    nested = []
+    for event in events:
+        name, seconds = event["name"], event.get("dur", 0) / 1e6
+        detail = event.get("args", {}).get("detail", "")
+        if name.startswith("Total "):
+            phases[name[6:]] = seconds
+            continue
+        if name == "Source":
+            headers[detail] = headers.get(detail, 0.0) + seconds
+        elif name in _clang_instantiations:
+            templates[detail] = templates.get(detail, 0.0) + seconds
+        label = f"{name} {detail}" if detail else name
+        nested.append((event.get("ts", 0) / 1e6, seconds, label))
+
+    # events nest inside those which start no later and end no earlier
+    frames: List[Frame] = []
+    stack: List[Tuple[float, float]] = []
+    first = min((start for start, *_ in nested), default=0.0)
+    for start, seconds, label in sorted(nested, key=lambda e: (e[0], -e[1])):
+        while stack and start >= stack[-1][1]:
+            stack.pop()
+        frames.append((len(stack), start - first, seconds, label))
+        stack.append((start, start + seconds))
+    total = phases.pop("ExecuteCompiler", max((f[2] for f in frames), default=0.0))
+    return Profile(
+        total, by_time(phases), [], by_time(headers), by_time(templates), frames
+    )
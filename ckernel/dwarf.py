@@ -0,0 +1,314 @@
+"""Read type layouts from DWARF debug info, as dumped by readelf"""
+from __future__ import annotations
+
+import re
+from html import escape
+from typing import Dict, List, NamedTuple, Optional, Sequence
+
+from .report import MimeBundle
+
+CACHE_LINE = 64
+
+# Matches the start of a DIE, e.g.
+# " <1><85>: Abbrev Number: 10 (DW_TAG_structure_type)"
+_die = re.compile(r"^\s*<(\d+)><([0-9a-f]+)>: Abbrev Number: \d+ \((DW_TAG_\w+)\)")
+
+# Matches an attribute, e.g. "    <86>   DW_AT_byte_size   : 56"
+_attribute = re.compile(r"^\s*<[0-9a-f]+>\s+(DW_AT_\w+)\s*: (.*)$")
+
+# Matches a reference to another DIE, e.g. "<0x72>"
+_reference = re.compile(r"^<0x([0-9a-f]+)>")
+
+# Tags which only qualify the type they refer to
+_qualifiers = {
+    "DW_TAG_typedef": "",
+    "DW_TAG_const_type": "const ",
+    "DW_TAG_volatile_type": "volatile ",
+    "DW_TAG_restrict_type": "",
+    "DW_TAG_atomic_type": "_Atomic ",
+}
+
+# Aggregate types and their keywords
+_aggregates = {
+    "DW_TAG_structure_type": "struct",
+    "DW_TAG_class_type": "class",
+    "DW_TAG_union_type": "union",
+}
+
+
+class DIE:
+    "A debugging information entry"
+
+    def __init__(self, offset: int, tag: str) -> None:
+        self.offset = offset
+        self.tag = tag
+        self.attrs: Dict[str, str] = {}
+        self.children: List[DIE] = []
+
+    def __repr__(self) -> str:
+        return f"{self.__class__.__name__}({self.offset:#x}, {self.tag})"
+
+    def number(self, attr: str) -> Optional[int]:
+        "Return the value of a numeric attribute, if present"
+        match = re.match(r"^(0x[0-9a-f]+|-?\d+)", self.attrs.get(attr, ""))
+        return int(match.group(1), 0) if match else None
+
+    def reference(self, attr: str) -> Optional[int]:
+        "Return the offset of the DIE an attribute refers to, if present"
+        match = _reference.match(self.attrs.get(attr, ""))
+        return int(match.group(1), 16) if match else None
+
+    @property
+    def name(self) -> str:
+        return self.attrs.get("DW_AT_name", "")
+
+
+class Member(NamedTuple):
+    name: str
+    type_name: str
+    offset: int  # in bytes
+    size: int  # in bytes, rounded up for bit-fields
+    align: int
+    bits: str  # e.g. ":3" for a bit-field, otherwise ""
+
+
+class Layout(NamedTuple):
+    name: str
+    size: int
+    members: List[Member]
+    align: int = 1  # the type's own alignment, which may be more than its members'
+    union: bool = False
+
+
+def parse_dies(lines: Sequence[str]) -> Dict[int, DIE]:
+    "Parse the output of readelf --debug-dump=info into DIEs by offset"
+    dies: Dict[int, DIE] = {}
+    stack: List[DIE] = []
+    current: Optional[DIE] = None
+    for text in lines:
+        if match := _die.match(text):
+            depth, offset = int(match.group(1)), int(match.group(2), 16)
+            current = DIE(offset, match.group(3))
+            dies[offset] = current
+            del stack[depth:]
+            if stack:
+                stack[-1].children.append(current)
+            stack.append(current)
+        elif current is not None and (match := _attribute.match(text)):
+            value = match.group(2).strip()
+            # drop the form and where strings are stored, which some versions
+            # of readelf show, e.g. "(strp) (offset: 0x43): name"
+            value = re.sub(r"^\(\w+\) ", "", value)
+            value = re.sub(r"^\((indirect|offset:) [^)]*\): ", "", value)
+            current.attrs[match.group(1)] = value
+    return dies
+
+
+class TypeInfo:
+    "Answer questions about the types in a set of DIEs"
+
+    def __init__(self, dies: Dict[int, DIE]) -> None:
+        self.dies = dies
+
+    def target(self, die: DIE) -> Optional[DIE]:
+        ref = die.reference("DW_AT_type")
+        return self.dies.get(ref) if ref is not None else None
+
+    def size(self, die: Optional[DIE]) -> int:
+        "Return the size in bytes of a type"
+        if die is None:
+            return 0
+        size = die.number("DW_AT_byte_size")
+        if size is not None:
+            return size
+        if die.tag == "DW_TAG_array_type":
+            count = 1
+            for subrange in die.children:
+                bound = subrange.number("DW_AT_count")
+                if bound is None:
+                    upper = subrange.number("DW_AT_upper_bound")
+                    bound = 0 if upper is None else upper + 1
+                count *= bound
+            return count * self.size(self.target(die))
+        return self.size(self.target(die))
+
+    def align(self, die: Optional[DIE]) -> int:
+        "Return the alignment in bytes of a type, estimated from its members"
+        if die is None:
+            return 1
+        explicit = die.number("DW_AT_alignment")
+        if explicit is not None:
+            return explicit
+        if die.tag in _aggregates:
+            return max((self.align(self.target(m)) for m in die.children), default=1)
+        if die.tag == "DW_TAG_array_type" or die.tag in _qualifiers:
+            return self.align(self.target(die))
+        return max(1, min(self.size(die), 16))
+
+    def type_name(self, die: Optional[DIE]) -> str:
+        "Return the name of a type as it would be written in C"
+        if die is None:
+            return "void"
+        if die.name:
+            if die.tag in _aggregates:
+                return f"{_aggregates[die.tag]} {die.name}"
+            return die.name
+        if die.tag in _qualifiers:
+            return _qualifiers[die.tag] + self.type_name(self.target(die))
+        if die.tag in ("DW_TAG_pointer_type", "DW_TAG_reference_type"):
+            suffix = "*" if die.tag == "DW_TAG_pointer_type" else "&"
+            return self.type_name(self.target(die)) + suffix
+        if die.tag == "DW_TAG_array_type":
+            dims = "".join(
+                f"[{(s.number('DW_AT_upper_bound') or 0) + 1}]"
+                if s.number("DW_AT_count") is None
+                else f"[{s.number('DW_AT_count')}]"
+                for s in die.children
+            )
+            return self.type_name(self.target(die)) + dims
+        if die.tag in _aggregates:
+            return f"{_aggregates[die.tag]} {{...}}"
+        return die.tag[7:]
+
+    def find(self, name: str) -> Optional[DIE]:
+        "Return the (complete) struct, class or union with the given name"
+        for die in self.dies.values():
+            if die.name != name:
+                continue
+            if die.tag == "DW_TAG_typedef":
+                die = self.target(die)
+                while die is not None and die.tag in _qualifiers:
+                    die = self.target(die)
+            if die is not None and die.tag in _aggregates:
+                if "DW_AT_declaration" not in die.attrs:
+                    return die
+        return None
+
+    def layout(self, name: str) -> Optional[Layout]:
+        "Return the layout of the named struct, class or union"
+        die = self.find(name)
+        if die is None:
+            return None
+        members = []
+        for child in die.children:
+            if child.tag not in ("DW_TAG_member", "DW_TAG_inheritance"):
+                continue
+            if "DW_AT_external" in child.attrs:
+                continue  # a static member
+            member_type = self.target(child)
+            size = self.size(member_type)
+            offset = child.number("DW_AT_data_member_location") or 0
+            bits = ""
+            bit_size = child.number("DW_AT_bit_size")
+            if bit_size is not None:
+                bit_offset = child.number("DW_AT_data_bit_offset")
+                if bit_offset is not None:
+                    offset = bit_offset // 8
+                    size = (bit_offset + bit_size + 7) // 8 - offset
+                bits = f":{bit_size}"
+            label = child.name or "<base>"
+            members.append(
+                Member(
+                    label,
+                    self.type_name(member_type),
+                    offset,
+                    size,
+                    self.align(member_type),
+                    bits,
+                )
+            )
+        union = die.tag == "DW_TAG_union_type"
+        return Layout(name, self.size(die), members, self.align(die), union)
+
+
+def member_bits(member: Member) -> int:
+    "Return the number of bits a member occupies"
+    return int(member.bits[1:]) if member.bits else 8 * member.size
+
+
+def packed_size(members: Sequence[Member], size: int, align: int = 1) -> int:
+    """Return the size of a struct with members laid out in the given order,
+    rounded up to the struct's own alignment or its members' if greater"""
+    offset = 0
+    for member in members:
+        offset = (offset + member.align - 1) // member.align * member.align
+        offset += member.size
+        align = max(align, member.align)
+    return max((offset + align - 1) // align * align, 0) if members else size
+
+
+def suggest_order(layout: Layout) -> Optional[List[Member]]:
+    """Return the members reordered by decreasing alignment (then size) if
+    that makes the struct smaller, otherwise None. Unions and structs with
+    bit-fields are left alone."""
+    offsets = {m.offset for m in layout.members}
+    if any(m.bits for m in layout.members) or len(offsets) < len(layout.members):
+        return None
+    # base class subobjects stay first
+    bases = [m for m in layout.members if m.name == "<base>"]
+    ordered = bases + sorted(
+        (m for m in layout.members if m not in bases), key=lambda m: (-m.align, -m.size)
+    )
+    if packed_size(ordered, layout.size, layout.align) < layout.size:
+        return ordered
+    return None
+
+
+def render(layouts: Sequence[Layout]) -> MimeBundle:
+    """Render the layout of each type in the style of pahole, marking holes,
+    padding and cache-line boundaries, with any smaller ordering suggested"""
+    text: List[str] = []
+    html: List[str] = ["<pre>"]
+
+    def add(line: str, colour: str = "") -> None:
+        text.append(line)
+        if colour:
+            html.append(f'<span style="color: {colour}">{escape(line)}</span>')
+        else:
+            html.append(escape(line))
+
+    for layout in layouts:
+        lines = (layout.size + CACHE_LINE - 1) // CACHE_LINE
+        width = max((len(m.type_name.split("[")[0]) for m in layout.members), default=0)
+        add(f"{layout.name} {{  /* size: {layout.size}, cachelines: {lines} */")
+        end, holes, hole_bytes, line = 0, 0, 0, 0
+        for member in layout.members:
+            if member.offset > end:
+                holes += 1
+                hole_bytes += member.offset - end
+                add(f"    /* XXX {member.offset - end} byte hole */", "#c44e52")
+            while member.offset >= (line + 1) * CACHE_LINE:
+                line += 1
+                boundary = f"cacheline {line} boundary ({line * CACHE_LINE} bytes)"
+                add(f"    /* --- {boundary} --- */", "#4c72b0")
+            # write arrays as in a declaration, e.g. "float m[3]"
+            type_name, bracket, dims = member.type_name.partition("[")
+            field = f"{type_name:<{width}} {member.name}{bracket}{dims}{member.bits};"
+            note = f"/* {member.offset:5d} {member.size:5d} */"
+            last = member.offset + max(member.size, 1) - 1
+            if member.offset // CACHE_LINE != last // CACHE_LINE:
+                add(f"    {field:<40s} {note}  <-- crosses a cache line", "#dd8452")
+            else:
+                add(f"    {field:<40s} {note}")
+            end = max(end, member.offset + member.size)
+        if layout.size > end:
+            add(f"    /* XXX {layout.size - end} bytes of padding */", "#c44e52")
+        # the members of a union overlap, so their total means nothing. The
+        # bits of bit-fields sharing a storage unit are summed before rounding.
+        total = (sum(member_bits(m) for m in layout.members) + 7) // 8
+        add(
+            ("};  /* " if layout.union else f"}};  /* members: {total} bytes, ")
+            + f"holes: {holes} ({hole_bytes} bytes), "
+            f"padding: {max(layout.size - end, 0)} bytes */"
+        )
+        ordered = suggest_order(layout)
+        if ordered is not None:
+            smaller = packed_size(ordered, layout.size, layout.align)
+            add(
+                f"/* reordering as {', '.join(m.name for m in ordered)} "
+                f"gives {smaller} bytes (saves {layout.size - smaller}) */",
+                "#55a868",
+            )
+        add("")
+    html.append("</pre>")
+    return {"text/plain": "\n".join(text), "text/html": "\n".join(html)}
@@ -0,0 +1,237 @@
+"""Describe and summarise experiments which run an executable many times"""
+from __future__ import annotations
+
+import itertools
+import os
+import random
+import re
+from typing import Dict, List, NamedTuple, Optional, Tuple
+
+Parameters = Dict[str, List[str]]
+
+
+class Variant(NamedTuple):
+    """One way of building the cell"""
+
+    label: str
+    compiler: str
+    cflags: str
+    ldflags: Optional[str] = None  # the cell's own if None
+
+
+class VariantResult(NamedTuple):
+    """The outcome of building and timing one variant. build_time is None if
+    the build failed and time is None if the variant failed to run."""
+
+    variant: Variant
+    exe: Optional[str]
+    build_time: Optional[float]
+    time: Optional[float]
+    stdout: List[str]
+
+
+# The flags AUTOTUNE searches by default for each compiler family: one
+# alternative is chosen from each group, and an empty alternative leaves the
+# group's flag out. Clang doesn't accept GCC's vectoriser cost models.
+_common_flag_space = [
+    ["-O2", "-O3", "-Ofast"],
+    ["", "-march=native"],
+    ["", "-funroll-loops"],
+    ["", "-flto"],
+]
+DEFAULT_FLAG_SPACES = {
+    "gcc": _common_flag_space
+    + [["", "-fvect-cost-model=unlimited", "-fvect-cost-model=cheap"]],
+    "clang": _common_flag_space,
+}
+
+# Matches "{threads}" or "{<n>*threads}" in a weak-scaling ARGS string
+_threads_placeholder = re.compile(r"\{(?:(\d+)\s*\*\s*)?threads\}")
+
+
+def parse_parameters(spec: str) -> Parameters:
+    "Parse a spec like 'A=1,2,4 B=x,y' into {'A': ['1', '2', '4'], 'B': ['x', 'y']}"
+    params: Parameters = {}
+    for item in spec.split():
+        name, sep, values = item.partition("=")
+        if not sep or not name or not values:
+            raise ValueError(f"expected NAME=value[,value...], got {item!r}")
+        params[name] = [value for value in values.split(",") if value]
+        if not params[name]:
+            raise ValueError(f"expected at least one value for {name}, got {item!r}")
+    return params
+
+
+def used_macros(code: str, values: Parameters) -> Parameters:
+    """Return the subset of values named by identifiers which appear in code,
+    ignoring the cell's //% option lines"""
+    code = re.sub(r"^\s*//%.*$", "", code, flags=re.M)
+    return {
+        name: value
+        for name, value in values.items()
+        if re.search(rf"\b{re.escape(name)}\b", code)
+    }
+
+
+def local_includes(filename: str) -> List[str]:
+    "Return the contents of the local headers #included by filename"
+    contents = []
+    directory = os.path.dirname(filename)
+    with open(filename, encoding="utf-8") as src:
+        for header in re.findall(r'^\s*#\s*include\s*"([^"]+)"', src.read(), re.M):
+            path = os.path.join(directory, header)
+            if os.path.isfile(path):
+                with open(path, encoding="utf-8") as included:
+                    contents.append(included.read())
+    return contents
+
+
+def expand(params: Parameters) -> List[Dict[str, str]]:
+    "Return every combination of the parameters' values"
+    names = list(params)
+    return [
+        dict(zip(names, values))
+        for values in itertools.product(*(params[name] for name in names))
+    ]
+
+
+def substitute(template: str, values: Dict[str, str]) -> str:
+    "Replace {NAME} placeholders in template with the corresponding values"
+    for name, value in values.items():
+        template = template.replace(f"{{{name}}}", value)
+    return template
+
+
+def capture(pattern: Optional[re.Pattern], stdout: List[str]) -> Dict[str, str]:
+    """Return the groups of the first match of pattern in stdout, named after
+    the pattern's named groups (or numbered if unnamed)"""
+    if pattern is None:
+        return {}
+    match = pattern.search("".join(stdout))
+    names = {index: name for name, index in pattern.groupindex.items()}
+    captured = {
+        names.get(k, f"capture {k}"): "" for k in range(1, pattern.groups + 1)
+    }
+    if match is not None:
+        for k, value in enumerate(match.groups(), start=1):
+            captured[names.get(k, f"capture {k}")] = value or ""
+    return captured
+
+
+def to_number(value: str) -> Optional[float]:
+    "Convert value to a float, or None if it isn't a number"
+    try:
+        return float(value)
+    except ValueError:
+        return None
+
+
+def series_by_first(
+    points: List[Dict[str, str]], values: List[float]
+) -> Optional[Tuple[List[float], Dict[str, List[float]]]]:
+    """Arrange values measured at points as one series per combination of all
+    but the first parameter, with the (numeric) first parameter as x. Returns
+    None if the first parameter isn't numeric."""
+    if not points:
+        return None
+    first = next(iter(points[0]))
+    xs: List[float] = []
+    series: Dict[str, List[float]] = {}
+    for point, value in zip(points, values):
+        x = to_number(point[first])
+        if x is None:
+            return None
+        if x not in xs:
+            xs.append(x)
+        label = " ".join(f"{k}={v}" for k, v in point.items() if k != first)
+        series.setdefault(label or "time", []).append(value)
+    return xs, series
+
+
+def scales_with_threads(exe_args: str) -> bool:
+    "Return whether exe_args has a {threads} or {n*threads} placeholder"
+    return _threads_placeholder.search(exe_args) is not None
+
+
+def substitute_threads(exe_args: str, threads: int) -> str:
+    "Replace {threads} or {n*threads} placeholders in exe_args"
+    return _threads_placeholder.sub(
+        lambda m: str(int(m.group(1) or 1) * threads), exe_args
+    )
+
+
+def karp_flatt(speedup: float, threads: float) -> Optional[float]:
+    "Return the experimentally determined serial fraction (undefined for 1 thread)"
+    if threads <= 1 or speedup <= 0:
+        return None
+    return (1 / speedup - 1 / threads) / (1 - 1 / threads)
+
+
+def scaling_metrics(threads: List[int], times: List[float], weak: bool) -> List[list]:
+    """Return rows of [threads, time, speed-up, efficiency %, Karp-Flatt] relative
+    to the first entry. For weak scaling the speed-up is the scaled speed-up,
+    which assumes the problem size grows with the thread count."""
+    base_threads, base_time = threads[0], times[0]
+    rows = []
+    for count, time in zip(threads, times):
+        ratio = count / base_threads
+        speedup = base_time / time * (ratio if weak else 1)
+        serial = karp_flatt(speedup, ratio)
+        rows.append(
+            [
+                count,
+                time,
+                speedup,
+                100 * speedup / ratio,
+                "-" if serial is None else serial,
+            ]
+        )
+    return rows
+
+
+def parse_flag_space(
+    spec: str, family: str = "gcc"
+) -> Tuple[Dict[str, str], List[List[str]]]:
+    """Parse an AUTOTUNE spec like 'budget=60 -O2|-O3 -funroll-loops' into its
+    settings and flag groups. Alternatives in a group are separated by '|' and
+    a single flag is optional. Returns the default flag space of the compiler
+    family if no groups are given."""
+    settings: Dict[str, str] = {}
+    space: List[List[str]] = []
+    for item in spec.split():
+        if not item.startswith("-") and "=" in item and "|" not in item:
+            name, _, value = item.partition("=")
+            settings[name] = value
+        elif "|" in item:
+            space.append(item.split("|"))
+        else:
+            space.append(["", item])
+    return settings, space or DEFAULT_FLAG_SPACES[family]
+
+
+def flags(space: List[List[str]], choice: Tuple[int, ...]) -> str:
+    "Return the flags chosen (by index) from each group of a flag space"
+    return " ".join(filter(None, (group[k] for group, k in zip(space, choice))))
+
+
+def neighbours(
+    space: List[List[str]], choice: Tuple[int, ...], group: int
+) -> List[Tuple[int, ...]]:
+    "Return the choices differing from choice only in the given group"
+    return [
+        choice[:group] + (k,) + choice[group + 1 :]
+        for k in range(len(space[group]))
+        if k != choice[group]
+    ]
+
+
+def random_choices(
+    space: List[List[str]], count: int, exclude, rng: random.Random
+) -> List[Tuple[int, ...]]:
+    "Return up to count distinct random choices from a flag space, not in exclude"
+    untried = [
+        choice
+        for choice in itertools.product(*(range(len(group)) for group in space))
+        if choice not in exclude
+    ]
+    return rng.sample(untried, min(count, len(untried)))
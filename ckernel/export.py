@@ -0,0 +1,154 @@
+"""Export the builds of a session's cells as a project which builds them with
+Ninja or CMake"""
+from __future__ import annotations
+
+import os
+import re
+import shlex
+from typing import Callable, List, NamedTuple
+
+_header = "# Builds the cells of a c-kernel session with the commands the kernel ran"
+
+
+class Step(NamedTuple):
+    "A command the kernel ran: compiler flags [-c] inputs ldflags -o output"
+    output: str
+    compiler: str
+    flags: str
+    inputs: List[str]
+    ldflags: str = ""
+    compile_only: bool = True
+
+
+def headers(filename: str) -> List[str]:
+    "Return the local headers #included by filename and by those headers"
+    found: List[str] = []
+    pending = [filename]
+    while pending:
+        source = pending.pop(0)
+        with open(source, encoding="utf-8") as src:
+            included = re.findall(r'^\s*#\s*include\s*"([^"]+)"', src.read(), re.M)
+        for header in included:
+            path = os.path.normpath(os.path.join(os.path.dirname(source), header))
+            if os.path.isfile(path) and path not in found:
+                found.append(path)
+                pending.append(path)
+    return found
+
+
+def relocate(step: Step, path: Callable[[str], str]) -> Step:
+    "Return the step with its files renamed within the project"
+    return step._replace(
+        output=path(step.output),
+        flags=step.flags.strip(),
+        inputs=[path(name) for name in step.inputs],
+        ldflags=step.ldflags.strip(),
+    )
+
+
+def _ninja_path(path: str) -> str:
+    return path.replace("$", "$$").replace(" ", "$ ").replace(":", "$:")
+
+
+def ninja(steps: List[Step], cwd: str) -> str:
+    """Return a build.ninja which runs the steps in the project directory, in
+    place of the session's directory cwd. The dependencies on headers come
+    from the compiler's depfiles."""
+
+    def flags(words: str) -> str:
+        return words.replace(cwd, ".").replace("$", "$$")
+
+    lines = [
+        _header,
+        "",
+        "rule compile",
+        "  command = $compiler $flags -MMD -MF $out.d -c $in -o $out",
+        "  depfile = $out.d",
+        "  deps = gcc",
+        "  description = compile $out",
+        "",
+        "rule link",
+        "  command = $compiler $flags -MMD -MF $out.d $in $ldflags -o $out",
+        "  depfile = $out.d",
+        "  deps = gcc",
+        "  description = link $out",
+    ]
+    for step in steps:
+        rule = "compile" if step.compile_only else "link"
+        inputs = " ".join(_ninja_path(name) for name in step.inputs)
+        lines += ["", f"build {_ninja_path(step.output)}: {rule} {inputs}"]
+        lines.append(f"  compiler = {step.compiler.replace('$', '$$')}")
+        lines.append(f"  flags = {flags(step.flags)}")
+        if not step.compile_only:
+            lines.append(f"  ldflags = {flags(step.ldflags)}")
+    return "\n".join(lines) + "\n"
+
+
+def _cmake_escape(word: str) -> str:
+    return re.sub(r'([\\"$;])', r"\\\1", word)
+
+
+def _cmake_quote(word: str) -> str:
+    return f'"{_cmake_escape(word)}"'
+
+
+def cmake(steps: List[Step], name: str, cwd: str) -> str:
+    """Return a CMakeLists.txt which runs the steps as custom commands in the
+    project directory, writing their outputs to the build directory. CMake's
+    own compilers and flags aren't used, so each cell keeps its compiler.
+    Sources are named by their full path in the project directory, in place
+    of the session's directory cwd, so that the depfiles name the headers by
+    their full path too."""
+    outputs = {step.output for step in steps}
+    source_dir = "${CMAKE_CURRENT_SOURCE_DIR}"
+
+    def path(name: str) -> str:
+        if name in outputs:
+            return '"${CMAKE_CURRENT_BINARY_DIR}/' + _cmake_quote(name)[1:]
+        if not os.path.isabs(name):
+            return f'"{source_dir}/' + _cmake_quote(name)[1:]
+        return _cmake_quote(name)
+
+    def flags(words: str) -> List[str]:
+        return [
+            '"' + source_dir.join(map(_cmake_escape, word.split(cwd))) + '"'
+            for word in shlex.split(words)
+        ]
+
+    project = re.sub(r"\W", "_", name) or "cells"
+    lines = [
+        _header,
+        "cmake_minimum_required(VERSION 3.20)",
+        f"project({project} LANGUAGES NONE)",
+    ]
+    for step in steps:
+        output = path(step.output)
+        depfile = output[:-1] + '.d"'
+        words = [_cmake_quote(step.compiler)]
+        words += flags(step.flags)
+        words += ["-MMD", "-MF", depfile]
+        words += ["-c"] if step.compile_only else []
+        words += [path(name) for name in step.inputs]
+        words += flags(step.ldflags)
+        words += ["-o", output]
+        depends = [
+            path(name)
+            for name in step.inputs
+            if name in outputs or not os.path.isabs(name)
+        ]
+        kind = "compile" if step.compile_only else "link"
+        lines += [
+            "",
+            "add_custom_command(",
+            f"  OUTPUT {output}",
+            f"  COMMAND {' '.join(words)}",
+            f"  DEPENDS {' '.join(depends)}",
+            f"  DEPFILE {depfile}",
+            f"  WORKING_DIRECTORY {source_dir}",
+            f"  COMMENT {_cmake_quote(f'{kind} {step.output}')}",
+            "  VERBATIM",
+            ")",
+        ]
+    targets = " ".join(path(step.output) for step in steps)
+    lines += ["", f"add_custom_target(cells ALL DEPENDS {targets})"]
+    return "\n".join(lines) + "\n"
@@ -0,0 +1,46 @@
+"""Link-time optimisation across the objects of several cells"""
+from __future__ import annotations
+
+from typing import NamedTuple, Optional
+
+
+class CellObject(NamedTuple):
+    "How a cell's object was compiled, so that it can be compiled again"
+    compiler: str
+    cflags: str
+    filename: str
+
+
+class LTOOptions(NamedTuple):
+    mode: str  # "full" or "thin"
+    jobs: Optional[int]  # parallel link jobs, or None to choose automatically
+
+
+def parse_options(spec: str) -> LTOOptions:
+    "Parse the options of LTO, e.g. 'thin jobs=8'"
+    mode, jobs = "full", None
+    for word in spec.split():
+        if word in ("full", "thin"):
+            mode = word
+        elif word.startswith("jobs="):
+            jobs = int(word[5:])
+            if jobs < 1:
+                raise ValueError("LTO jobs must be at least 1")
+        else:
+            raise ValueError(f"unknown LTO option {word}")
+    return LTOOptions(mode, jobs)
+
+
+def compile_flag(mode: str, family: str) -> str:
+    "Return the flag to compile for LTO. GCC has no thin LTO."
+    if family == "clang":
+        return f"-flto={mode}"
+    return "-flto"
+
+
+def link_flags(options: LTOOptions, family: str, cpus: int) -> str:
+    """Return the flags to link with LTO, partitioning the work over parallel
+    jobs"""
+    if family == "clang":
+        return f"-flto={options.mode} -flto-jobs={options.jobs or cpus}"
+    return f"-flto={options.jobs}" if options.jobs else "-flto=auto"
@@ -20,6 +20,7 @@ import jupyter_client
 from ipykernel.kernelapp import IPKernelApp
 
 import ckernel
+from ckernel import profiles
 from ckernel.autocompile_kernel import AutoCompileKernel
 
 KernelSpec = TypedDict(
@@ -204,6 +205,32 @@ def main(prog: typing.Optional[str] = None) -> None:
         dest="exe_ldflags",
         metavar="LDFLAGS",
     )
+    parse_install.add_argument(
+        "--mpicc",
+        help="the MPI C compiler wrapper to use for MPI cells (default: mpicc)",
+    )
+    parse_install.add_argument(
+        "--mpicxx",
+        help="the MPI C++ compiler wrapper to use for MPI cells (default: mpicxx)",
+    )
+    parse_install.add_argument(
+        "--mpirun",
+        help="the MPI launcher to use for MPI cells (default: mpirun or mpiexec)",
+    )
+    parse_install.add_argument(
+        "--profile",
+        action="append",
+        default=[],
+        metavar="NAME=SPEC",
+        help="define a build profile, e.g. fast=opt=-O3,march=native,lto=thin "
+        "(fields: opt, debug, march, lto, linker, cflags, ldflags)",
+    )
+    parse_install.add_argument(
+        "--default-profile",
+        dest="default_profile",
+        metavar="NAME",
+        help="the build profile to use unless a notebook or cell chooses another",
+    )
     parse_install.add_argument(
         "--user", action="store_true", help="install per-user only"
     )
@@ -270,6 +297,26 @@ def main(prog: typing.Optional[str] = None) -> None:
             env["CKERNEL_EXE_CXXFLAGS"] = args.exe_cxxflags
         if args.exe_ldflags:
             env["CKERNEL_EXE_LDFLAGS"] = args.exe_ldflags
+        if args.mpicc:
+            env["CKERNEL_MPICC"] = args.mpicc
+        if args.mpicxx:
+            env["CKERNEL_MPICXX"] = args.mpicxx
+        if args.mpirun:
+            env["CKERNEL_MPIRUN"] = args.mpirun
+        specs = {}
+        for definition in args.profile:
+            name, _, spec = definition.partition("=")
+            try:
+                profiles.parse_profile(name, spec)
+            except ValueError as err:
+                parser.error(str(err))
+            specs[name] = spec
+        if specs:
+            env["CKERNEL_PROFILES"] = json.dumps(specs)
+        if args.default_profile:
+            if args.default_profile not in {**profiles.DEFAULT_PROFILES, **specs}:
+                parser.error(f"unknown profile {args.default_profile}")
+            env["CKERNEL_PROFILE"] = args.default_profile
         with tempdir() as specdir:
             installed = install(
                 specdir,
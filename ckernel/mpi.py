@@ -0,0 +1,104 @@
+"""Launch MPI executables and label their output by rank"""
+from __future__ import annotations
+
+import re
+import time
+import uuid
+from html import escape
+from typing import Callable, Dict, List, NamedTuple, Optional, Set, Tuple
+
+
+class MPILauncher(NamedTuple):
+    """How to launch an MPI job and recognise the rank of each output line"""
+
+    command: str
+    tag_flags: str
+    tag_pattern: re.Pattern
+    env: dict[str, str]
+
+    def launch(self, ranks: int, extra_flags: str = "") -> str:
+        "Return the command prefix which launches ranks processes"
+        return f"{self.command} -np {ranks} {self.tag_flags} {extra_flags}".strip()
+
+    def split_rank(self, line: str) -> Tuple[Optional[int], str]:
+        "Split a tagged line of output into its rank and text"
+        match = self.tag_pattern.match(line)
+        if match is None:
+            return None, line
+        return int(match.group(1)), line[match.end() :]
+
+
+def detect_launcher(command: str, version_output: str, as_root: bool) -> MPILauncher:
+    "Describe the launcher command, given the output of `command --version`"
+    if "Open MPI" in version_output or "OpenRTE" in version_output:
+        env = {}
+        if as_root:
+            env["OMPI_ALLOW_RUN_AS_ROOT"] = "1"
+            env["OMPI_ALLOW_RUN_AS_ROOT_CONFIRM"] = "1"
+        return MPILauncher(
+            command,
+            "--tag-output --oversubscribe",
+            re.compile(r"\[\d+,(\d+)\]<(?:stdout|stderr|stddiag)>: ?"),
+            env,
+        )
+    # MPICH, Intel MPI and derivatives use the Hydra process manager
+    return MPILauncher(command, "-prepend-rank", re.compile(r"\[(\d+)\] ?"), {})
+
+
+class RankOutputs:
+    """Optionally collect each rank's output into its own collapsible display,
+    which is updated as more output arrives. Each update resends all of the
+    rank's output, so a rank's display is updated at most once per interval
+    (in seconds) and the rest is shown by flush."""
+
+    def __init__(
+        self, display: Callable[..., None], split: bool, interval: float = 0.5
+    ) -> None:
+        self._display = display
+        self._split = split
+        self._interval = interval
+        self._prefix = f"ckernel-mpi-{uuid.uuid4().hex}"
+        self._outputs: Dict[int, List[Tuple[str, str]]] = {}
+        self._shown: Dict[int, float] = {}  # when each rank was last displayed
+        self._pending: Set[int] = set()  # ranks with output not yet displayed
+
+    def add(self, rank: int, text: str, dest: str) -> bool:
+        "Add output from rank, returning False if outputs aren't being split"
+        if not self._split:
+            return False
+        self._outputs.setdefault(rank, []).append((text, dest))
+        self._pending.add(rank)
+        if time.monotonic() - self._shown.get(rank, -self._interval) >= self._interval:
+            self.show(rank)
+        return True
+
+    def show(self, rank: int) -> None:
+        "Display the output of rank, replacing its earlier display"
+        self._display(
+            self.bundle(rank),
+            display_id=f"{self._prefix}-{rank}",
+            update=rank in self._shown,
+        )
+        self._shown[rank] = time.monotonic()
+        self._pending.discard(rank)
+
+    def flush(self) -> None:
+        "Display the output which arrived since each rank was last displayed"
+        for rank in sorted(self._pending):
+            self.show(rank)
+
+    def bundle(self, rank: int) -> Dict[str, str]:
+        "Return the display data for one rank's output"
+        outputs = self._outputs[rank]
+        text = "".join(text for text, _ in outputs)
+        html = "".join(
+            f'<span style="color:#c00">{escape(text)}</span>'
+            if dest == "stderr"
+            else escape(text)
+            for text, dest in outputs
+        )
+        return {
+            "text/plain": f"rank {rank}:\n{text}",
+            "text/html": f"<details open><summary>rank {rank}</summary>"
+            f"<pre>{html}</pre></details>",
+        }
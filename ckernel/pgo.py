@@ -0,0 +1,47 @@
+"""Profile-guided optimisation with GCC or Clang"""
+from __future__ import annotations
+
+from pathlib import Path
+from typing import NamedTuple
+
+
+class PGOOptions(NamedTuple):
+    runs: int  # training runs of the instrumented executable
+    stdin: str  # a file to feed to each training run, or ""
+
+
+def parse_options(spec: str) -> PGOOptions:
+    "Parse the options of PGO, e.g. 'runs=3 stdin=train.txt'"
+    runs, stdin = 1, ""
+    for word in spec.split():
+        key, _, value = word.partition("=")
+        if key == "runs" and value.isdigit() and int(value) > 0:
+            runs = int(value)
+        elif key == "stdin" and value:
+            stdin = value
+        else:
+            raise ValueError(f"unknown PGO option {word}")
+    return PGOOptions(runs, stdin)
+
+
+def generate_flags(family: str) -> str:
+    "Return the flags to build an instrumented executable"
+    if family == "clang":
+        return "-fprofile-instr-generate"
+    return "-fprofile-generate -fprofile-update=prefer-atomic"
+
+
+def use_flags(family: str, directory: Path) -> str:
+    """Return the flags to build with the profile trained in directory. GCC
+    finds its profile next to the object, so both builds must write the same
+    object."""
+    if family == "clang":
+        return f"-fprofile-instr-use={directory / 'merged.profdata'}"
+    return "-fprofile-use -fprofile-correction -Wno-missing-profile"
+
+
+def trained(family: str, directory: Path, obj_name: str) -> bool:
+    "Return whether the directory holds a profile ready to use"
+    if family == "clang":
+        return (directory / "merged.profdata").exists()
+    return (directory / obj_name).with_suffix(".gcda").exists()
@@ -0,0 +1,214 @@
+"""Summarise the output of the bundled profiling libraries"""
+from __future__ import annotations
+
+import os
+from typing import Any, Dict, List, Tuple
+
+from . import report
+from .report import MimeBundle
+
+# (value, size, name) of a symbol as reported by `nm -S`
+Symbol = Tuple[int, int, str]
+
+
+def parse_nm(lines: List[str]) -> List[Symbol]:
+    "Parse the output of `nm -S -C` into a list of sized symbols"
+    symbols: List[Symbol] = []
+    for line in lines:
+        parts = line.rstrip().split(maxsplit=3)
+        if len(parts) == 4:
+            try:
+                symbols.append((int(parts[0], 16), int(parts[1], 16), parts[3]))
+            except ValueError:
+                continue
+    return symbols
+
+
+def symbolise(address: int, symbols: List[Symbol]) -> str:
+    "Return the name of the symbol containing address (+offset), if any"
+    for value, size, name in symbols:
+        if value <= address < value + size:
+            offset = address - value
+            return f"{name}+{offset}" if offset else name
+    return hex(address)
+
+
+def lock_name(lock: Dict[str, Any], symbols: Dict[str, List[Symbol]]) -> str:
+    "Return the symbol naming a lock, or its address if it isn't in a file"
+    if not lock.get("file") or lock["file"] not in symbols:
+        return lock["lock"]
+    return symbolise(lock["offset"], symbols[lock["file"]])
+
+
+def pthread_trace_report(
+    trace: Dict[str, Any], symbols: Dict[str, List[Symbol]]
+) -> List[MimeBundle]:
+    """Return a lock contention table and a thread timeline for a pthread trace.
+    symbols are those of each file which contains a lock, by file name."""
+    bundles: List[MimeBundle] = []
+    locks = sorted(trace.get("ckLocks", []), key=lambda lock: -lock["wait_us"])
+    rows = [
+        [
+            lock_name(lock, symbols),
+            lock["acquired"],
+            lock["contended"],
+            100.0 * lock["contended"] / lock["acquired"],
+            lock["wait_us"] / 1000,
+            lock["max_wait_us"] / 1000,
+            lock["hold_us"] / 1000,
+        ]
+        for lock in locks
+    ]
+    headers = [
+        "lock",
+        "acquired",
+        "contended",
+        "contended %",
+        "wait (ms)",
+        "max wait (ms)",
+        "held (ms)",
+    ]
+    bundles.append(report.table(headers, rows, title="Lock contention"))
+
+    lanes: Dict[int, List[Tuple[float, float, str]]] = {}
+    for event in trace.get("traceEvents", []):
+        lanes.setdefault(event["tid"], []).append(
+            (event["ts"], event["dur"], event["name"])
+        )
+    title = "Thread timeline"
+    if trace.get("ckDroppedEvents"):
+        title += f" (earliest {trace['ckDroppedEvents']} waits not recorded)"
+    bundles.append(
+        report.timeline(
+            [(f"thread {tid}", lanes[tid]) for tid in sorted(lanes)], title=title
+        )
+    )
+    return bundles
+
+
+def parse_addr2line(lines: List[str], addresses: List[int]) -> Dict[int, str]:
+    "Parse the output of `addr2line -f -C` for the given addresses"
+    names: Dict[int, str] = {}
+    lines = [line.strip() for line in lines]
+    for address, function, location in zip(addresses, lines[::2], lines[1::2]):
+        location = location.split(" ")[0]
+        if location.startswith("??"):
+            names[address] = function if function != "??" else hex(address)
+        else:
+            names[address] = f"{function} ({os.path.basename(location)})"
+    return names
+
+
+def imbalance(values: List[float]) -> float:
+    "Return the load imbalance (max / mean - 1) of values as a percentage"
+    mean = sum(values) / len(values) if values else 0
+    return 100 * (max(values) / mean - 1) if mean > 0 else 0.0
+
+
+def region_name(region: Dict[str, Any], names: Dict[Tuple[str, int], str]) -> str:
+    "Return the name of an OpenMP region, or the address of its code"
+    return names.get((region.get("file", ""), region["offset"]), hex(region["offset"]))
+
+
+def ompt_profile_report(
+    profile: Dict[str, Any], names: Dict[Tuple[str, int], str], max_regions: int = 5
+) -> List[MimeBundle]:
+    """Return a summary table of OpenMP parallel regions and, for the most
+    costly regions, the balance of work and barrier wait across threads. names
+    are the regions' names by their file and offset."""
+    bundles: List[MimeBundle] = []
+    regions = sorted(profile.get("regions", []), key=lambda r: -r["total_ms"])
+    rows = []
+    for region in regions:
+        threads = region["threads"]
+        work = [t["task_ms"] - t["wait_ms"] for t in threads]
+        wait = sum(t["wait_ms"] for t in threads)
+        task = sum(t["task_ms"] for t in threads)
+        loops = [t["loop_ms"] for t in threads]
+        rows.append(
+            [
+                region_name(region, names),
+                region["count"],
+                len(threads),
+                region["total_ms"],
+                region["total_ms"] / region["count"] if region["count"] else 0.0,
+                100 * wait / task if task else 0.0,
+                imbalance(work),
+                imbalance(loops) if any(loops) else "-",
+            ]
+        )
+    headers = [
+        "region",
+        "calls",
+        "threads",
+        "total (ms)",
+        "mean (ms)",
+        "barrier wait %",
+        "work imbalance %",
+        "loop imbalance %",
+    ]
+    bundles.append(report.table(headers, rows, title="OpenMP parallel regions"))
+    for region in regions[:max_regions]:
+        lanes = []
+        for index, thread in enumerate(region["threads"]):
+            work = thread["task_ms"] - thread["wait_ms"]
+            lanes.append(
+                (
+                    f"thread {index}",
+                    [(0.0, work, "work"), (work, thread["wait_ms"], "barrier wait")],
+                )
+            )
+        name = region_name(region, names)
+        bundles.append(report.timeline(lanes, title=f"Balance: {name}", unit="ms"))
+    return bundles
+
+
+def pmpi_profile_report(profiles: List[Dict[str, Any]]) -> List[MimeBundle]:
+    """Return a table of MPI calls, a communication matrix and a breakdown of
+    compute and communication time for the per-rank profiles"""
+    profiles = sorted(profiles, key=lambda profile: profile["rank"])
+    totals: Dict[str, List[float]] = {}
+    for profile in profiles:
+        for name, stats in profile["calls"].items():
+            total = totals.setdefault(name, [0, 0.0, 0])
+            total[0] += stats["count"]
+            total[1] += stats["time"]
+            total[2] += stats["bytes"]
+    rows = [
+        [name, count, 1000 * time, 1e6 * time / count, nbytes, nbytes / count]
+        for name, (count, time, nbytes) in sorted(
+            totals.items(), key=lambda item: -item[1][1]
+        )
+    ]
+    headers = [
+        "call",
+        "calls",
+        "time (ms)",
+        "mean (us)",
+        "bytes",
+        "mean bytes",
+    ]
+    bundles = [report.table(headers, rows, title="MPI calls (all ranks)")]
+    labels = [str(profile["rank"]) for profile in profiles]
+    bundles.append(
+        report.heatmap(
+            labels,
+            [profile["sent_bytes"] for profile in profiles],
+            title="Bytes sent (row: sender, column: receiver)",
+            unit="bytes",
+        )
+    )
+    lanes = []
+    for profile in profiles:
+        mpi_ms = 1000 * sum(stats["time"] for stats in profile["calls"].values())
+        compute_ms = max(1000 * profile["elapsed"] - mpi_ms, 0.0)
+        lanes.append(
+            (
+                f"rank {profile['rank']}",
+                [(0.0, compute_ms, "compute"), (compute_ms, mpi_ms, "MPI")],
+            )
+        )
+    bundles.append(
+        report.timeline(lanes, title="Compute vs communication", unit="ms")
+    )
+    return bundles
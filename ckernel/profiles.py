@@ -0,0 +1,93 @@
+"""Named build profiles, which bundle the flags for a kind of build"""
+from __future__ import annotations
+
+import json
+from typing import Dict, NamedTuple, Optional
+
+
+class BuildProfile(NamedTuple):
+    name: str
+    optimisation: str = "-O2"
+    debug: bool = False
+    march: str = ""
+    lto: str = ""  # "", "full" or "thin"
+    linker: str = ""  # e.g. "lld" or "gold"
+    cflags: str = ""  # any other compiler flags
+    ldflags: str = ""  # any other linker flags
+
+    def lto_flag(self, clang: bool) -> str:
+        "The LTO flag of this profile. Only Clang has thin LTO."
+        if not self.lto:
+            return ""
+        return "-flto=thin" if self.lto == "thin" and clang else "-flto"
+
+    def compile_flags(self, clang: bool = False) -> str:
+        "The flags to compile with under this profile"
+        flags = [self.optimisation]
+        if self.debug:
+            flags.append("-g")
+        if self.march:
+            flags.append(f"-march={self.march}")
+        flags.append(self.lto_flag(clang))
+        flags.append(self.cflags)
+        return " ".join(flag for flag in flags if flag)
+
+    def link_flags(self, clang: bool = False) -> str:
+        "The extra flags to link with under this profile"
+        flags = [self.lto_flag(clang)]
+        if self.linker:
+            flags.append(f"-fuse-ld={self.linker}")
+        flags.append(self.ldflags)
+        return " ".join(flag for flag in flags if flag)
+
+    def describe(self) -> str:
+        "Describe the flags of this profile"
+        link = f" (link: {self.link_flags()})" if self.link_flags() else ""
+        return f"{self.name}: {self.compile_flags()}{link}"
+
+
+DEFAULT_PROFILES = {
+    profile.name: profile
+    for profile in [
+        BuildProfile("debug", optimisation="-O0", debug=True),
+        BuildProfile("release", cflags="-DNDEBUG"),
+        BuildProfile(
+            "profile", debug=True, cflags="-fno-omit-frame-pointer -DNDEBUG"
+        ),
+        BuildProfile(
+            "native", optimisation="-O3", march="native", lto="full", cflags="-DNDEBUG"
+        ),
+    ]
+}
+
+
+def parse_profile(name: str, spec: str) -> BuildProfile:
+    """Parse a profile from a spec like 'opt=-O3,march=native,lto=thin,debug'.
+    Flags containing commas can't be given in a spec."""
+    fields: Dict[str, object] = {}
+    keys = {"opt": "optimisation", "optimisation": "optimisation"}
+    for item in spec.split(","):
+        key, has_value, value = item.strip().partition("=")
+        if not key:
+            continue
+        key = keys.get(key, key)
+        if key not in BuildProfile._fields or key == "name":
+            raise ValueError(f"unknown field {key} in profile {name}")
+        if key == "debug":
+            fields[key] = not has_value or value.lower() in ("1", "true", "yes", "on")
+        elif key == "lto" and not has_value:
+            fields[key] = "full"
+        else:
+            fields[key] = value
+    if fields.get("lto") not in (None, "", "full", "thin"):
+        raise ValueError(f"lto must be full or thin in profile {name}")
+    return BuildProfile(name, **fields)
+
+
+def load(installed: Optional[str]) -> Dict[str, BuildProfile]:
+    """Return the default profiles updated with those installed with the
+    kernel, given as JSON mapping each name to its spec"""
+    found = dict(DEFAULT_PROFILES)
+    for name, spec in json.loads(installed or "{}").items():
+        found[name] = parse_profile(name, spec)
+    return found
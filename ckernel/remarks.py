@@ -0,0 +1,162 @@
+"""Parse and render compiler optimisation remarks"""
+from __future__ import annotations
+
+import os
+import re
+from html import escape
+from typing import Dict, Iterable, List, NamedTuple, Sequence
+
+from .report import MimeBundle
+
+# The categories a remark can be filtered by, in display order, and the
+# colour each is shown in
+CATEGORIES = {
+    "vectorized": "#55a868",
+    "inlined": "#4c72b0",
+    "optimized": "#8172b3",
+    "missed": "#c44e52",
+    "note": "#8c8c8c",
+}
+
+DEFAULT_CATEGORIES = ["vectorized", "inlined", "optimized", "missed"]
+
+
+# Matches a GCC remark, e.g. "dot.c:5:23: optimized: loop vectorized using..."
+_gcc_remark = re.compile(r"^(.+?):(\d+):(\d+): (optimized|missed|note): +(.*)$")
+
+# Matches a field of a Clang remark, e.g. "Pass:            loop-vectorize"
+_clang_field = re.compile(r"^(\w+):\s*(.*)$")
+
+# Matches an argument of a Clang remark, e.g. "  - String: 'vectorized loop'"
+_clang_arg = re.compile(r"^\s+- (\w+):\s*(.*)$")
+
+# Matches the file and line of a Clang DebugLoc
+_clang_loc = re.compile(r"File:\s*'?([^,']+)'?,\s*Line:\s*(\d+)")
+
+
+class Remark(NamedTuple):
+    line: int
+    category: str
+    message: str
+
+
+def parse_categories(spec: str) -> List[str]:
+    """Parse a list of categories like 'missed,vectorised'. An empty spec
+    gives the default categories and 'all' gives every category."""
+    words = spec.replace(",", " ").lower().split()
+    words = ["vectorized" if word == "vectorised" else word for word in words]
+    if not words:
+        return DEFAULT_CATEGORIES
+    if "all" in words:
+        return list(CATEGORIES)
+    unknown = set(words) - set(CATEGORIES)
+    if unknown:
+        raise ValueError(f"unknown remark categories {', '.join(sorted(unknown))}")
+    return [category for category in CATEGORIES if category in words]
+
+
+def flags(family: str, path: str) -> str:
+    "Return the flags which make a compiler of a family write remarks to path"
+    if family == "clang":
+        return f"-fsave-optimization-record -foptimization-record-file={path}"
+    return f"-fopt-info-all={path}"
+
+
+def categorise(kind: str, message: str) -> str:
+    "Return the category of a remark of the given kind"
+    if kind == "missed":
+        return "missed"
+    if kind == "note":
+        return "note"
+    if "vectoriz" in message.lower():
+        return "vectorized"
+    if "inlin" in message.lower():
+        return "inlined"
+    return "optimized"
+
+
+def parse_gcc(lines: Iterable[str], source: str) -> List[Remark]:
+    """Parse the output of -fopt-info-all, keeping the remarks about source.
+    The reasons GCC gives for not vectorising a loop are attached to the
+    loop's line."""
+    remarks: List[Remark] = []
+    source_name = os.path.basename(source)
+    loop_line = None
+    for text in lines:
+        match = _gcc_remark.match(text.rstrip())
+        if match is None:
+            continue
+        path, line, _, kind, message = match.groups()
+        if os.path.basename(path) != source_name:
+            continue
+        line = int(line)
+        if kind == "missed" and message.startswith("couldn't vectorize loop"):
+            loop_line = line
+        elif kind == "missed" and message.startswith("not vectorized") and loop_line:
+            if line != loop_line:
+                message = f"{message} (line {line})"
+            line = loop_line
+        else:
+            loop_line = None
+        remarks.append(Remark(line, categorise(kind, message), message))
+    return remarks
+
+
+def parse_clang(text: str, source: str) -> List[Remark]:
+    "Parse the YAML records of -fsave-optimization-record about source"
+    kinds = {"Passed": "optimized", "Missed": "missed", "Analysis": "note"}
+    remarks: List[Remark] = []
+    source_name = os.path.basename(source)
+    for document in text.split("--- !")[1:]:
+        kind, *lines = document.splitlines()
+        fields: Dict[str, str] = {}
+        args: List[str] = []
+        for line in lines:
+            if match := _clang_arg.match(line):
+                name, value = match.groups()
+                if name != "DebugLoc":
+                    args.append(value.strip("'\""))
+            elif match := _clang_field.match(line):
+                fields[match.group(1)] = match.group(2)
+        location = _clang_loc.search(fields.get("DebugLoc", ""))
+        if location is None or os.path.basename(location.group(1)) != source_name:
+            continue
+        message = "".join(args) or fields.get("Name", "")
+        if fields.get("Pass") == "inline" and kind == "Passed":
+            category = "inlined"
+        elif fields.get("Pass") == "loop-vectorize" and kind == "Passed":
+            category = "vectorized"
+        else:
+            category = categorise(kinds.get(kind.strip(), "note"), message)
+        remarks.append(Remark(int(location.group(2)), category, message))
+    return remarks
+
+
+def render(
+    remarks: Sequence[Remark], source_lines: Sequence[str], categories: Sequence[str]
+) -> MimeBundle:
+    """Render the cell's source with the remarks in the given categories shown
+    under the lines they concern"""
+    by_line: Dict[int, List[Remark]] = {}
+    for remark in remarks:
+        if remark.category in categories:
+            notes = by_line.setdefault(remark.line, [])
+            if remark not in notes:
+                notes.append(remark)
+    counts = {c: sum(1 for r in remarks if r.category == c) for c in categories}
+    title = "Optimisation remarks: " + ", ".join(
+        f"{count} {category}" for category, count in counts.items()
+    )
+    text = [title]
+    html = [f"<b>{escape(title)}</b>", "<pre>"]
+    for number, code in enumerate(source_lines, start=1):
+        code = f"{number:4d} | {code.rstrip()}"
+        text.append(code)
+        html.append(escape(code))
+        for remark in by_line.get(number, []):
+            note = f"     ^ {remark.category}: {remark.message}"
+            text.append(note)
+            colour = CATEGORIES[remark.category]
+            html.append(f'<span style="color: {colour}">{escape(note)}</span>')
+    html.append("</pre>")
+    return {"text/plain": "\n".join(text), "text/html": "\n".join(html)}
@@ -0,0 +1,246 @@
+"""Render tables and simple charts for display in a notebook"""
+from __future__ import annotations
+
+from html import escape
+from typing import Dict, List, Optional, Sequence, Tuple
+
+# Colours used for successive series/categories in charts
+PALETTE = [
+    "#4c72b0",
+    "#dd8452",
+    "#55a868",
+    "#c44e52",
+    "#8172b3",
+    "#937860",
+    "#da8bc3",
+    "#8c8c8c",
+]
+
+MimeBundle = Dict[str, str]
+
+
+def format_value(value) -> str:
+    "Format a table cell"
+    if isinstance(value, float):
+        return f"{value:.6g}"
+    return str(value)
+
+
+def table(
+    headers: Sequence[str], rows: Sequence[Sequence], title: Optional[str] = None
+) -> MimeBundle:
+    "Return a table as plain text and HTML"
+    cells = [[format_value(value) for value in row] for row in rows]
+    widths = [
+        max([len(header)] + [len(row[k]) for row in cells])
+        for k, header in enumerate(headers)
+    ]
+    lines = [title] if title else []
+    lines.append("  ".join(h.ljust(w) for h, w in zip(headers, widths)).rstrip())
+    lines.append("  ".join("-" * w for w in widths))
+    for row, cell_row in zip(rows, cells):
+        lines.append(
+            "  ".join(
+                c.rjust(w) if isinstance(v, (int, float)) else c.ljust(w)
+                for v, c, w in zip(row, cell_row, widths)
+            ).rstrip()
+        )
+    html = ["<table>"]
+    if title:
+        html.append(f"<caption>{escape(title)}</caption>")
+    html.append("<tr>" + "".join(f"<th>{escape(h)}</th>" for h in headers) + "</tr>")
+    for row in cells:
+        html.append("<tr>" + "".join(f"<td>{escape(c)}</td>" for c in row) + "</tr>")
+    html.append("</table>")
+    return {"text/plain": "\n".join(lines), "text/html": "\n".join(html)}
+
+
+def _svg(width: int, height: int, body: List[str]) -> str:
+    return "\n".join(
+        [
+            f'<svg xmlns="http://www.w3.org/2000/svg" width="{width}" '
+            f'height="{height}" font-family="sans-serif" font-size="11">',
+            *body,
+            "</svg>",
+        ]
+    )
+
+
+def _text(x: float, y: float, text: str, anchor: str = "start", **attrs) -> str:
+    extra = "".join(f' {k.replace("_", "-")}="{v}"' for k, v in attrs.items())
+    return (
+        f'<text x="{x:.1f}" y="{y:.1f}" text-anchor="{anchor}"{extra}>'
+        f"{escape(text)}</text>"
+    )
+
+
+def bar_chart(
+    labels: Sequence[str], values: Sequence[float], title: str, unit: str = ""
+) -> MimeBundle:
+    "Return a horizontal bar chart as SVG"
+    label_width = 8 + 7 * max((len(label) for label in labels), default=0)
+    bar_width, row_height = 400, 18
+    height = 30 + row_height * len(values)
+    top = max(values, default=0) or 1
+    body = [_text(4, 14, title, font_weight="bold")]
+    for k, (label, value) in enumerate(zip(labels, values)):
+        y = 24 + k * row_height
+        length = bar_width * value / top
+        body.append(_text(label_width - 4, y + 12, label, anchor="end"))
+        body.append(
+            f'<rect x="{label_width}" y="{y}" width="{length:.1f}" '
+            f'height="{row_height - 4}" fill="{PALETTE[0]}"/>'
+        )
+        body.append(_text(label_width + length + 4, y + 12, f"{value:.4g} {unit}"))
+    svg = _svg(label_width + bar_width + 100, height, body)
+    return {"image/svg+xml": svg, "text/plain": title}
+
+
+def line_chart(
+    xs: Sequence[float],
+    series: Dict[str, Sequence[float]],
+    title: str,
+    xlabel: str,
+    ylabel: str,
+) -> MimeBundle:
+    "Return a line chart of one or more series as SVG"
+    width, height, left, bottom = 480, 300, 60, 40
+    plot_w, plot_h = width - left - 120, height - bottom - 30
+    ys = [y for values in series.values() for y in values]
+    x_lo, x_hi = min(xs), max(xs)
+    y_lo, y_hi = min(0.0, min(ys, default=0)), max(ys, default=1) or 1
+    x_span = (x_hi - x_lo) or 1
+    y_span = (y_hi - y_lo) or 1
+
+    def point(x: float, y: float) -> Tuple[float, float]:
+        return (
+            left + plot_w * (x - x_lo) / x_span,
+            30 + plot_h * (1 - (y - y_lo) / y_span),
+        )
+
+    body = [_text(4, 14, title, font_weight="bold")]
+    body.append(
+        f'<rect x="{left}" y="30" width="{plot_w}" height="{plot_h}" '
+        'fill="none" stroke="#999"/>'
+    )
+    for x in xs:
+        px, _ = point(x, y_lo)
+        body.append(_text(px, 30 + plot_h + 14, format_value(x), anchor="middle"))
+    for y in (y_lo, (y_lo + y_hi) / 2, y_hi):
+        _, py = point(x_lo, y)
+        body.append(_text(left - 4, py + 4, f"{y:.3g}", anchor="end"))
+    body.append(_text(left + plot_w / 2, height - 6, xlabel, anchor="middle"))
+    body.append(
+        _text(
+            12,
+            30 + plot_h / 2,
+            ylabel,
+            anchor="middle",
+            transform=f"rotate(-90 12 {30 + plot_h / 2:.1f})",
+        )
+    )
+    for k, (name, values) in enumerate(series.items()):
+        colour = PALETTE[k % len(PALETTE)]
+        points = " ".join("%.1f,%.1f" % point(x, y) for x, y in zip(xs, values))
+        body.append(
+            f'<polyline points="{points}" fill="none" stroke="{colour}" '
+            'stroke-width="2"/>'
+        )
+        body.append(_text(left + plot_w + 8, 40 + 16 * k, name, fill=colour))
+    return {"image/svg+xml": _svg(width, height, body), "text/plain": title}
+
+
+def timeline(
+    lanes: Sequence[Tuple[str, Sequence[Tuple[float, float, str]]]],
+    title: str,
+    unit: str = "us",
+) -> MimeBundle:
+    """Return a timeline as SVG. Each lane is a label and a list of
+    (start, duration, category) intervals. Later intervals are drawn on top."""
+    categories: List[str] = []
+    for _, intervals in lanes:
+        for *_, category in intervals:
+            if category not in categories:
+                categories.append(category)
+    colours = {c: PALETTE[k % len(PALETTE)] for k, c in enumerate(categories)}
+    ends = [start + dur for _, intervals in lanes for start, dur, _ in intervals]
+    end = max(ends, default=1) or 1
+    left, plot_w, lane_h = 90, 600, 16
+    height = 50 + lane_h * len(lanes) + 16
+    body = [_text(4, 14, title, font_weight="bold")]
+    for k, (label, intervals) in enumerate(lanes):
+        y = 24 + k * lane_h
+        body.append(_text(left - 4, y + 11, label, anchor="end"))
+        for start, dur, category in intervals:
+            x = left + plot_w * start / end
+            w = max(plot_w * dur / end, 0.5)
+            body.append(
+                f'<rect x="{x:.1f}" y="{y}" width="{w:.1f}" '
+                f'height="{lane_h - 3}" fill="{colours[category]}"/>'
+            )
+    y = 24 + len(lanes) * lane_h + 12
+    body.append(_text(left, y, "0", anchor="middle"))
+    body.append(_text(left + plot_w, y, f"{end:.6g} {unit}", anchor="middle"))
+    x = left
+    for category in categories:
+        body.append(
+            f'<rect x="{x}" y="{y + 8}" width="10" height="10" '
+            f'fill="{colours[category]}"/>'
+        )
+        body.append(_text(x + 14, y + 17, category))
+        x += 24 + 7 * len(category)
+    svg = _svg(left + plot_w + 60, height + 14, body)
+    return {"image/svg+xml": svg, "text/plain": title}
+
+
+def heatmap(
+    labels: Sequence[str], matrix: Sequence[Sequence[float]], title: str, unit: str
+) -> MimeBundle:
+    """Return a heatmap of a square matrix as SVG, with rows labelled on the
+    left and columns along the top"""
+    cell, left, top = 28, 60, 50
+    peak = max((value for row in matrix for value in row), default=0) or 1
+    size = cell * len(labels)
+    body = [_text(4, 14, title, font_weight="bold")]
+    for k, label in enumerate(labels):
+        body.append(_text(left + cell * (k + 0.5), top - 6, label, anchor="middle"))
+        body.append(_text(left - 4, top + cell * (k + 0.5) + 4, label, anchor="end"))
+    for i, row in enumerate(matrix):
+        for j, value in enumerate(row):
+            shade = int(255 * (1 - value / peak))
+            body.append(
+                f'<rect x="{left + cell * j}" y="{top + cell * i}" width="{cell}" '
+                f'height="{cell}" fill="rgb({shade},{shade},255)" stroke="#fff">'
+                f"<title>{escape(labels[i])} to {escape(labels[j])}: "
+                f"{value:.6g} {escape(unit)}</title></rect>"
+            )
+    body.append(_text(left, top + size + 16, f"max {peak:.6g} {unit}"))
+    svg = _svg(left + size + 20, top + size + 24, body)
+    return {"image/svg+xml": svg, "text/plain": title}
+
+
+def flame_graph(
+    frames: Sequence[Tuple[int, float, float, str]], title: str, unit: str = "s"
+) -> MimeBundle:
+    """Return a flame graph as SVG. Each frame is a (depth, start, duration,
+    label) tuple, with the outermost frames at depth 0 drawn at the bottom."""
+    left, plot_w, row_h = 4, 800, 16
+    depth = max((frame[0] for frame in frames), default=0) + 1
+    end = max((start + dur for _, start, dur, _ in frames), default=1) or 1
+    height = 24 + row_h * depth
+    body = [_text(4, 14, title, font_weight="bold")]
+    for level, start, dur, label in frames:
+        x = left + plot_w * start / end
+        w = max(plot_w * dur / end, 0.5)
+        y = 20 + row_h * (depth - 1 - level)
+        colour = PALETTE[level % len(PALETTE)]
+        body.append(
+            f'<rect x="{x:.1f}" y="{y}" width="{w:.1f}" height="{row_h - 1}" '
+            f'fill="{colour}"><title>{escape(label)}: {dur:.6g} {unit}</title></rect>'
+        )
+        chars = int(w / 7)
+        if chars >= 4:
+            text = label if len(label) <= chars else label[: chars - 2] + ".."
+            body.append(_text(x + 2, y + 12, text, fill="#fff"))
+    svg = _svg(left + plot_w + 4, height + 4, body)
+    return {"image/svg+xml": svg, "text/plain": title}
@@ -0,0 +1,227 @@
+/**
+ * A small preload shim which serves large allocations from anonymous mappings
+ * aligned to the transparent huge page size and advised with MADV_HUGEPAGE.
+ *
+ * Allocations below CK_HUGEPAGES_THRESHOLD bytes (default: the huge page size)
+ * are passed on to the next allocator in the chain, so this shim can be
+ * combined with a preloaded allocator such as jemalloc.
+ *
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h> // for dlsym
+#include <errno.h>
+#include <malloc.h> // for malloc_usable_size
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define CK_HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define CK_MAX_HUGE_ALLOCS 4096
+#define CK_BOOTSTRAP_SIZE 4096
+
+#define CKERROR(fmt, ...) fprintf(stderr, "[ck_hugepages] " fmt "\n", __VA_ARGS__)
+
+// pointers to the next allocator's functions
+struct alloc_fp {
+  void *(*malloc)(size_t);
+  void *(*calloc)(size_t, size_t);
+  void *(*realloc)(void *, size_t);
+  void (*free)(void *);
+  int (*posix_memalign)(void **, size_t, size_t);
+  size_t (*malloc_usable_size)(void *);
+};
+
+static struct alloc_fp afp = {0};
+
+// each huge allocation records its mapping so free/realloc can recognise it
+struct huge_alloc {
+  void *ptr;
+  void *base;
+  size_t length;
+  size_t size;
+};
+
+static struct huge_alloc huge_allocs[CK_MAX_HUGE_ALLOCS];
+static pthread_mutex_t huge_allocs_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t threshold = CK_HUGE_PAGE_SIZE;
+
+// dlsym may allocate before afp is ready, so serve those requests from here
+static char bootstrap[CK_BOOTSTRAP_SIZE];
+static size_t bootstrap_used = 0;
+
+static bool is_bootstrap(void *ptr) {
+  return ((char *)ptr >= bootstrap) &&
+         ((char *)ptr < bootstrap + CK_BOOTSTRAP_SIZE);
+}
+
+static void *bootstrap_alloc(size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  if (bootstrap_used + size > CK_BOOTSTRAP_SIZE) {
+    return NULL;
+  }
+  void *ptr = bootstrap + bootstrap_used;
+  bootstrap_used += size;
+  return ptr;
+}
+
+static void __attribute__((constructor)) ck_hugepages_setup(void) {
+  if (afp.malloc != NULL) {
+    return;
+  }
+  afp.malloc = dlsym(RTLD_NEXT, "malloc");
+  afp.calloc = dlsym(RTLD_NEXT, "calloc");
+  afp.realloc = dlsym(RTLD_NEXT, "realloc");
+  afp.free = dlsym(RTLD_NEXT, "free");
+  afp.posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+  afp.malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+  const char *value = getenv("CK_HUGEPAGES_THRESHOLD");
+  if (value != NULL) {
+    threshold = strtoull(value, NULL, 10);
+  }
+}
+
+static void *huge_alloc(size_t size) {
+  size_t length = size + CK_HUGE_PAGE_SIZE;
+  void *base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  uintptr_t aligned = ((uintptr_t)base + CK_HUGE_PAGE_SIZE - 1) &
+                      ~(uintptr_t)(CK_HUGE_PAGE_SIZE - 1);
+  void *ptr = (void *)aligned;
+  if (madvise(ptr, size, MADV_HUGEPAGE) != 0) {
+    CKERROR("madvise failed [Error %d: %s]", errno, strerror(errno));
+  }
+  pthread_mutex_lock(&huge_allocs_lock);
+  for (size_t k = 0; k < CK_MAX_HUGE_ALLOCS; k++) {
+    if (huge_allocs[k].ptr == NULL) {
+      huge_allocs[k] = (struct huge_alloc){ptr, base, length, size};
+      pthread_mutex_unlock(&huge_allocs_lock);
+      return ptr;
+    }
+  }
+  pthread_mutex_unlock(&huge_allocs_lock);
+  // table full: the caller falls back to the next allocator
+  munmap(base, length);
+  return NULL;
+}
+
+// serve size from a huge allocation if possible, otherwise return NULL
+static void *try_huge_alloc(size_t size) {
+  return (size >= threshold) ? huge_alloc(size) : NULL;
+}
+
+// find ptr in the table, returning true and the record if it was there. If
+// release is true, the entry is also removed from the table
+static bool huge_lookup(void *ptr, struct huge_alloc *record, bool release) {
+  bool found = false;
+  // huge allocations are always aligned, which keeps the common path cheap
+  if (((uintptr_t)ptr & (CK_HUGE_PAGE_SIZE - 1)) != 0) {
+    return false;
+  }
+  pthread_mutex_lock(&huge_allocs_lock);
+  for (size_t k = 0; k < CK_MAX_HUGE_ALLOCS; k++) {
+    if (huge_allocs[k].ptr == ptr) {
+      *record = huge_allocs[k];
+      if (release) {
+        huge_allocs[k].ptr = NULL;
+      }
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&huge_allocs_lock);
+  return found;
+}
+
+void *malloc(size_t size) {
+  if (afp.malloc == NULL) {
+    return bootstrap_alloc(size);
+  }
+  void *ptr = try_huge_alloc(size);
+  return (ptr != NULL) ? ptr : afp.malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  if (afp.calloc == NULL) {
+    // bootstrap memory is static, so already zeroed
+    return bootstrap_alloc(nmemb * size);
+  }
+  if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  // anonymous mappings are zero-filled
+  void *ptr = try_huge_alloc(nmemb * size);
+  return (ptr != NULL) ? ptr : afp.calloc(nmemb, size);
+}
+
+void free(void *ptr) {
+  struct huge_alloc record;
+  if (ptr == NULL || is_bootstrap(ptr)) {
+    return;
+  }
+  if (huge_lookup(ptr, &record, true)) {
+    munmap(record.base, record.length);
+  } else {
+    afp.free(ptr);
+  }
+}
+
+void *realloc(void *ptr, size_t size) {
+  struct huge_alloc record;
+  if (ptr == NULL) {
+    return malloc(size);
+  }
+  if (is_bootstrap(ptr) || huge_lookup(ptr, &record, false)) {
+    size_t old_size = is_bootstrap(ptr)
+                          ? (size_t)(bootstrap + CK_BOOTSTRAP_SIZE - (char *)ptr)
+                          : record.size;
+    void *new_ptr = malloc(size);
+    if (new_ptr == NULL) {
+      // the caller's block must survive a failed realloc
+      return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    if (!is_bootstrap(ptr) && huge_lookup(ptr, &record, true)) {
+      munmap(record.base, record.length);
+    }
+    return new_ptr;
+  }
+  void *new_ptr = try_huge_alloc(size);
+  if (new_ptr != NULL) {
+    size_t old_size = afp.malloc_usable_size(ptr);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    afp.free(ptr);
+    return new_ptr;
+  }
+  return afp.realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  void *ptr = (alignment <= CK_HUGE_PAGE_SIZE) ? try_huge_alloc(size) : NULL;
+  if (ptr != NULL) {
+    *memptr = ptr;
+    return 0;
+  }
+  return afp.posix_memalign(memptr, alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  void *ptr = NULL;
+  return (posix_memalign(&ptr, alignment, size) == 0) ? ptr : NULL;
+}
+
+size_t malloc_usable_size(void *ptr) {
+  struct huge_alloc record;
+  if (ptr != NULL && huge_lookup(ptr, &record, false)) {
+    return record.size;
+  }
+  return afp.malloc_usable_size(ptr);
+}
@@ -166,6 +166,18 @@ static void __attribute__((constructor)) ck_setup(void) {
   ATTACH_FP(ifp, getdelim);
 #endif
 
+  // under an MPI launcher only rank 0 receives stdin, so other ranks must
+  // never request input
+  const char *rank_vars[] = {"OMPI_COMM_WORLD_RANK", "PMI_RANK", "PMIX_RANK"};
+  for (size_t k = 0; k < sizeof(rank_vars) / sizeof(rank_vars[0]); k++) {
+    const char *rank = getenv(rank_vars[k]);
+    if (rank != NULL && strcmp(rank, "0") != 0) {
+      CKDEBUG("MPI rank %s, not requesting input", rank);
+      request_input = false;
+      return;
+    }
+  }
+
   // get the specified semaphore from the environment
   const char *sem_key = NULL;
   if ((sem_key = getenv("CK_SEMKEY")) == NULL) {
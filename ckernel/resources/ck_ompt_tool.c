@@ -0,0 +1,325 @@
+/**
+ * An OMPT tool which profiles OpenMP parallel regions. Load it with
+ * OMP_TOOL_LIBRARIES; it requires an OpenMP runtime with OMPT support (e.g.
+ * LLVM's libomp).
+ *
+ * For each parallel region (identified by its code pointer) it records the
+ * number of times the region ran and its total duration and, per thread, the
+ * time spent in the implicit task, waiting in barriers and executing
+ * worksharing loops. At exit the profile is written as JSON to the file named
+ * by the CK_OMPT_PROFILE environment variable.
+ *
+ * The OMPT declarations needed are repeated here (from OpenMP 5.0) because
+ * omp-tools.h is usually only installed with clang.
+ *
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h> // for dladdr
+#include <inttypes.h>
+#if defined(__ELF__)
+#include <link.h> // for ElfW
+#endif
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CK_MAX_REGIONS 256
+#define CK_MAX_THREADS 256
+
+#define CKERROR(fmt, ...) fprintf(stderr, "[ck_ompt_tool] " fmt "\n", __VA_ARGS__)
+
+/* ---------------- OMPT declarations (OpenMP 5.0, section 4) ---------------- */
+
+typedef union ompt_data_t {
+  uint64_t value;
+  void *ptr;
+} ompt_data_t;
+
+typedef struct ompt_frame_t ompt_frame_t;
+typedef void (*ompt_interface_fn_t)(void);
+typedef ompt_interface_fn_t (*ompt_function_lookup_t)(const char *);
+typedef void (*ompt_callback_t)(void);
+typedef int (*ompt_set_callback_t)(int event, ompt_callback_t callback);
+typedef int (*ompt_initialize_t)(ompt_function_lookup_t lookup,
+                                 int initial_device_num, ompt_data_t *data);
+typedef void (*ompt_finalize_t)(ompt_data_t *data);
+
+typedef struct ompt_start_tool_result_t {
+  ompt_initialize_t initialize;
+  ompt_finalize_t finalize;
+  ompt_data_t tool_data;
+} ompt_start_tool_result_t;
+
+enum {
+  ompt_callback_parallel_begin = 3,
+  ompt_callback_parallel_end = 4,
+  ompt_callback_implicit_task = 7,
+  ompt_callback_sync_region_wait = 16,
+  ompt_callback_work = 20,
+};
+
+enum { ompt_scope_begin = 1, ompt_scope_end = 2 };
+enum { ompt_task_initial = 0x1 };
+enum { ompt_work_loop = 1, ompt_work_loop_static = 10, ompt_work_loop_other = 13 };
+enum { ompt_set_never = 1 };
+
+/* -------------------------------------------------------------------------- */
+
+struct thread_stats {
+  atomic_uint_fast64_t task_ns;
+  atomic_uint_fast64_t wait_ns;
+  atomic_uint_fast64_t loop_ns;
+  atomic_uint_fast64_t loop_count;
+};
+
+struct region {
+  const void *codeptr;
+  atomic_uint_fast64_t count;
+  atomic_uint_fast64_t total_ns;
+  atomic_uint max_threads;
+  struct thread_stats threads[CK_MAX_THREADS];
+};
+
+// the state of the implicit task this thread is executing
+struct task_state {
+  struct region *region;
+  unsigned index;
+  uint64_t task_begin;
+  uint64_t wait_begin;
+  uint64_t loop_begin;
+};
+
+static struct region regions[CK_MAX_REGIONS];
+static unsigned num_regions = 0;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct task_state task = {0};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static struct region *find_region(const void *codeptr) {
+  struct region *region = NULL;
+  pthread_mutex_lock(&regions_lock);
+  for (unsigned k = 0; k < num_regions; k++) {
+    if (regions[k].codeptr == codeptr) {
+      region = &regions[k];
+      break;
+    }
+  }
+  if (region == NULL && num_regions < CK_MAX_REGIONS) {
+    region = &regions[num_regions++];
+    region->codeptr = codeptr;
+  }
+  pthread_mutex_unlock(&regions_lock);
+  return region;
+}
+
+static void on_parallel_begin(ompt_data_t *encountering_task_data,
+                              const ompt_frame_t *encountering_task_frame,
+                              ompt_data_t *parallel_data,
+                              unsigned int requested_parallelism, int flags,
+                              const void *codeptr_ra) {
+  (void)encountering_task_data, (void)encountering_task_frame;
+  (void)requested_parallelism, (void)flags;
+  struct region *region = find_region(codeptr_ra);
+  parallel_data->ptr = region;
+  if (region != NULL) {
+    // several threads may encounter the same region at once, e.g. when nested
+    atomic_fetch_add(&region->count, 1);
+    atomic_fetch_sub(&region->total_ns, now_ns());
+  }
+}
+
+static void on_parallel_end(ompt_data_t *parallel_data,
+                            ompt_data_t *encountering_task_data, int flags,
+                            const void *codeptr_ra) {
+  (void)encountering_task_data, (void)flags, (void)codeptr_ra;
+  struct region *region = parallel_data->ptr;
+  if (region != NULL) {
+    atomic_fetch_add(&region->total_ns, now_ns());
+  }
+}
+
+static struct thread_stats *this_thread_stats(void) {
+  if (task.region == NULL || task.index >= CK_MAX_THREADS) {
+    return NULL;
+  }
+  return &task.region->threads[task.index];
+}
+
+static void on_implicit_task(int endpoint, ompt_data_t *parallel_data,
+                             ompt_data_t *task_data,
+                             unsigned int actual_parallelism,
+                             unsigned int index, int flags) {
+  (void)task_data;
+  if (flags & ompt_task_initial) {
+    return;
+  }
+  if (endpoint == ompt_scope_begin) {
+    task.region = parallel_data ? parallel_data->ptr : NULL;
+    task.index = index;
+    task.task_begin = now_ns();
+    if (task.region != NULL && index == 0) {
+      unsigned current = atomic_load(&task.region->max_threads);
+      while (actual_parallelism > current &&
+             !atomic_compare_exchange_weak(&task.region->max_threads, &current,
+                                           actual_parallelism))
+        ;
+    }
+  } else {
+    struct thread_stats *stats = this_thread_stats();
+    if (stats != NULL) {
+      atomic_fetch_add(&stats->task_ns, now_ns() - task.task_begin);
+    }
+    task.region = NULL;
+  }
+}
+
+static void on_sync_region_wait(int kind, int endpoint,
+                                ompt_data_t *parallel_data,
+                                ompt_data_t *task_data,
+                                const void *codeptr_ra) {
+  (void)kind, (void)parallel_data, (void)task_data, (void)codeptr_ra;
+  if (endpoint == ompt_scope_begin) {
+    task.wait_begin = now_ns();
+  } else {
+    struct thread_stats *stats = this_thread_stats();
+    if (stats != NULL) {
+      atomic_fetch_add(&stats->wait_ns, now_ns() - task.wait_begin);
+    }
+  }
+}
+
+static void on_work(int work_type, int endpoint, ompt_data_t *parallel_data,
+                    ompt_data_t *task_data, uint64_t count,
+                    const void *codeptr_ra) {
+  (void)parallel_data, (void)task_data, (void)codeptr_ra;
+  if (work_type != ompt_work_loop &&
+      (work_type < ompt_work_loop_static || work_type > ompt_work_loop_other)) {
+    return;
+  }
+  if (endpoint == ompt_scope_begin) {
+    task.loop_begin = now_ns();
+  } else {
+    struct thread_stats *stats = this_thread_stats();
+    if (stats != NULL) {
+      atomic_fetch_add(&stats->loop_ns, now_ns() - task.loop_begin);
+      atomic_fetch_add(&stats->loop_count, count);
+    }
+  }
+}
+
+static void set_callback(ompt_set_callback_t set, int event,
+                         ompt_callback_t callback, const char *name) {
+  if (set(event, callback) == ompt_set_never) {
+    CKERROR("the OpenMP runtime never provides %s", name);
+  }
+}
+
+#define SET_CALLBACK(set, event, fn)                                           \
+  set_callback((set), ompt_callback_##event, (ompt_callback_t)(fn), #event)
+
+static int ck_ompt_initialize(ompt_function_lookup_t lookup,
+                              int initial_device_num, ompt_data_t *data) {
+  (void)initial_device_num, (void)data;
+  ompt_set_callback_t set = (ompt_set_callback_t)lookup("ompt_set_callback");
+  if (set == NULL) {
+    CKERROR("%s", "failed to find ompt_set_callback");
+    return 0;
+  }
+  SET_CALLBACK(set, parallel_begin, on_parallel_begin);
+  SET_CALLBACK(set, parallel_end, on_parallel_end);
+  SET_CALLBACK(set, implicit_task, on_implicit_task);
+  SET_CALLBACK(set, sync_region_wait, on_sync_region_wait);
+  SET_CALLBACK(set, work, on_work);
+  return 1; // keep the tool active
+}
+
+static double to_ms(uint64_t ns) { return (double)ns / 1e6; }
+
+// Return the address of code as addr2line sees it in the file which contains
+// it, naming the file. Only position-independent (ET_DYN) files are loaded
+// away from the addresses in their symbol table.
+static uintptr_t file_address(const void *addr, const char **file) {
+  Dl_info info = {0};
+  *file = "";
+  if (dladdr(addr, &info) == 0 || info.dli_fbase == NULL) {
+    return (uintptr_t)addr;
+  }
+  *file = info.dli_fname ? info.dli_fname : "";
+#if defined(__ELF__)
+  const ElfW(Ehdr) *header = info.dli_fbase;
+  if (header->e_type != ET_DYN) {
+    return (uintptr_t)addr;
+  }
+#endif
+  return (uintptr_t)addr - (uintptr_t)info.dli_fbase;
+}
+
+static void write_json_string(FILE *out, const char *text) {
+  fputc('"', out);
+  for (; *text != '\0'; text++) {
+    if (*text == '"' || *text == '\\') {
+      fputc('\\', out);
+    }
+    fputc(*text, out);
+  }
+  fputc('"', out);
+}
+
+static void ck_ompt_finalize(ompt_data_t *data) {
+  (void)data;
+  const char *path = getenv("CK_OMPT_PROFILE");
+  if (path == NULL) {
+    return;
+  }
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    CKERROR("failed to open %s", path);
+    return;
+  }
+  fprintf(out, "{\"regions\":[\n");
+  for (unsigned k = 0; k < num_regions; k++) {
+    struct region *region = &regions[k];
+    // locate the region within its file so the kernel can name it
+    const char *file;
+    uintptr_t offset = file_address(region->codeptr, &file);
+    fprintf(out, "%s{\"file\":", k ? ",\n" : "");
+    write_json_string(out, file);
+    fprintf(out,
+            ",\"offset\":%" PRIuPTR ",\"count\":%" PRIu64
+            ",\"total_ms\":%.6f,\"threads\":[",
+            offset, (uint64_t)atomic_load(&region->count),
+            to_ms(atomic_load(&region->total_ns)));
+    unsigned max_threads = atomic_load(&region->max_threads);
+    unsigned nthreads =
+        max_threads < CK_MAX_THREADS ? max_threads : CK_MAX_THREADS;
+    for (unsigned t = 0; t < nthreads; t++) {
+      struct thread_stats *stats = &region->threads[t];
+      fprintf(out,
+              "%s{\"task_ms\":%.6f,\"wait_ms\":%.6f,\"loop_ms\":%.6f,"
+              "\"loop_count\":%" PRIu64 "}",
+              t ? "," : "", to_ms(atomic_load(&stats->task_ns)),
+              to_ms(atomic_load(&stats->wait_ns)),
+              to_ms(atomic_load(&stats->loop_ns)),
+              (uint64_t)atomic_load(&stats->loop_count));
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+}
+
+ompt_start_tool_result_t *ompt_start_tool(unsigned int omp_version,
+                                          const char *runtime_version) {
+  (void)omp_version, (void)runtime_version;
+  static ompt_start_tool_result_t result = {ck_ompt_initialize,
+                                            ck_ompt_finalize, {0}};
+  return &result;
+}
@@ -0,0 +1,326 @@
+/**
+ * A PMPI interposition library which profiles MPI communication. Compile it
+ * with the same MPI compiler wrapper as the executable and preload it.
+ *
+ * Each rank records the number of calls, time and bytes for each wrapped MPI
+ * function and the bytes and messages it sends to every other rank of
+ * MPI_COMM_WORLD. At MPI_Finalize each rank writes its profile as JSON to
+ * "<CK_PMPI_PROFILE>.<rank>.json".
+ *
+ */
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CKERROR(fmt, ...)                                                      \
+  fprintf(stderr, "[ck_pmpi_profiler] " fmt "\n", __VA_ARGS__)
+
+enum call_id {
+  CALL_Send,
+  CALL_Recv,
+  CALL_Isend,
+  CALL_Irecv,
+  CALL_Sendrecv,
+  CALL_Wait,
+  CALL_Waitall,
+  CALL_Barrier,
+  CALL_Bcast,
+  CALL_Reduce,
+  CALL_Allreduce,
+  CALL_Gather,
+  CALL_Scatter,
+  CALL_Allgather,
+  CALL_Alltoall,
+  NUM_CALLS
+};
+
+static const char *call_names[NUM_CALLS] = {
+    "MPI_Send",
+    "MPI_Recv",
+    "MPI_Isend",
+    "MPI_Irecv",
+    "MPI_Sendrecv",
+    "MPI_Wait",
+    "MPI_Waitall",
+    "MPI_Barrier",
+    "MPI_Bcast",
+    "MPI_Reduce",
+    "MPI_Allreduce",
+    "MPI_Gather",
+    "MPI_Scatter",
+    "MPI_Allgather",
+    "MPI_Alltoall",
+};
+
+struct call_stats {
+  uint64_t count;
+  double time;
+  uint64_t bytes;
+};
+
+static struct call_stats calls[NUM_CALLS];
+static uint64_t *sent_bytes = NULL; // indexed by destination world rank
+static uint64_t *sent_msgs = NULL;
+static int world_rank = 0, world_size = 0;
+static double init_time = 0.0;
+static MPI_Group world_group;
+
+static void ck_profile_init(void) {
+  PMPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  PMPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+  sent_bytes = calloc((size_t)world_size, sizeof(*sent_bytes));
+  sent_msgs = calloc((size_t)world_size, sizeof(*sent_msgs));
+  init_time = PMPI_Wtime();
+}
+
+static uint64_t message_bytes(int count, MPI_Datatype datatype) {
+  int size = 0;
+  if (datatype == MPI_DATATYPE_NULL || PMPI_Type_size(datatype, &size) != 0) {
+    return 0;
+  }
+  return (uint64_t)count * (uint64_t)size;
+}
+
+// record a message of bytes sent to rank dest of comm
+static void record_send(MPI_Comm comm, int dest, uint64_t bytes) {
+  if (sent_bytes == NULL || dest < 0) {
+    return; // MPI_PROC_NULL, or before MPI_Init
+  }
+  int world_dest = dest;
+  if (comm != MPI_COMM_WORLD) {
+    // dest is a rank of the remote group of an intercommunicator
+    int inter = 0;
+    MPI_Group group;
+    PMPI_Comm_test_inter(comm, &inter);
+    if (inter) {
+      PMPI_Comm_remote_group(comm, &group);
+    } else {
+      PMPI_Comm_group(comm, &group);
+    }
+    PMPI_Group_translate_ranks(group, 1, &dest, world_group, &world_dest);
+    PMPI_Group_free(&group);
+  }
+  if (world_dest >= 0 && world_dest < world_size) {
+    sent_bytes[world_dest] += bytes;
+    sent_msgs[world_dest]++;
+  }
+}
+
+// the bytes a receive actually received, which may be fewer than it posted
+static uint64_t received_bytes(const MPI_Status *status,
+                               MPI_Datatype datatype) {
+  int count = 0;
+  if (PMPI_Get_count(status, datatype, &count) != MPI_SUCCESS ||
+      count == MPI_UNDEFINED) {
+    return 0;
+  }
+  return message_bytes(count, datatype);
+}
+
+static void record_call(enum call_id id, double start, uint64_t bytes) {
+  calls[id].count++;
+  calls[id].time += PMPI_Wtime() - start;
+  calls[id].bytes += bytes;
+}
+
+int MPI_Init(int *argc, char ***argv) {
+  int result = PMPI_Init(argc, argv);
+  ck_profile_init();
+  return result;
+}
+
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided) {
+  int result = PMPI_Init_thread(argc, argv, required, provided);
+  ck_profile_init();
+  return result;
+}
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest,
+             int tag, MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Send(buf, count, datatype, dest, tag, comm);
+  uint64_t bytes = message_bytes(count, datatype);
+  record_call(CALL_Send, start, bytes);
+  record_send(comm, dest, bytes);
+  return result;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+             MPI_Comm comm, MPI_Status *status) {
+  MPI_Status ignored;
+  if (status == MPI_STATUS_IGNORE) {
+    status = &ignored;
+  }
+  double start = PMPI_Wtime();
+  int result = PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+  record_call(CALL_Recv, start,
+              result == MPI_SUCCESS ? received_bytes(status, datatype) : 0);
+  return result;
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request *request) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+  uint64_t bytes = message_bytes(count, datatype);
+  record_call(CALL_Isend, start, bytes);
+  record_send(comm, dest, bytes);
+  return result;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+              MPI_Comm comm, MPI_Request *request) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+  record_call(CALL_Irecv, start, message_bytes(count, datatype));
+  return result;
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 int dest, int sendtag, void *recvbuf, int recvcount,
+                 MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm,
+                 MPI_Status *status) {
+  double start = PMPI_Wtime();
+  int result =
+      PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf,
+                    recvcount, recvtype, source, recvtag, comm, status);
+  uint64_t bytes = message_bytes(sendcount, sendtype);
+  record_call(CALL_Sendrecv, start, bytes);
+  record_send(comm, dest, bytes);
+  return result;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Wait(request, status);
+  record_call(CALL_Wait, start, 0);
+  return result;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Waitall(count, requests, statuses);
+  record_call(CALL_Waitall, start, 0);
+  return result;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Barrier(comm);
+  record_call(CALL_Barrier, start, 0);
+  return result;
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root,
+              MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Bcast(buffer, count, datatype, root, comm);
+  record_call(CALL_Bcast, start, message_bytes(count, datatype));
+  return result;
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+               MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+  record_call(CALL_Reduce, start, message_bytes(count, datatype));
+  return result;
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+  record_call(CALL_Allreduce, start, message_bytes(count, datatype));
+  return result;
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+               MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                           recvtype, root, comm);
+  record_call(CALL_Gather, start, message_bytes(sendcount, sendtype));
+  return result;
+}
+
+int MPI_Scatter(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+                MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                            recvtype, root, comm);
+  record_call(CALL_Scatter, start, message_bytes(recvcount, recvtype));
+  return result;
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                              recvtype, comm);
+  record_call(CALL_Allgather, start, message_bytes(sendcount, sendtype));
+  return result;
+}
+
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 MPI_Comm comm) {
+  double start = PMPI_Wtime();
+  int result = PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                             recvtype, comm);
+  record_call(CALL_Alltoall, start, message_bytes(sendcount, sendtype));
+  return result;
+}
+
+static void ck_profile_dump(double elapsed) {
+  const char *prefix = getenv("CK_PMPI_PROFILE");
+  if (prefix == NULL) {
+    return;
+  }
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.%d.json", prefix, world_rank);
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    CKERROR("failed to open %s", path);
+    return;
+  }
+  fprintf(out, "{\"rank\":%d,\"size\":%d,\"elapsed\":%.9f,\"calls\":{",
+          world_rank, world_size, elapsed);
+  const char *sep = "";
+  for (int k = 0; k < NUM_CALLS; k++) {
+    if (calls[k].count == 0) {
+      continue;
+    }
+    fprintf(out, "%s\"%s\":{\"count\":%llu,\"time\":%.9f,\"bytes\":%llu}", sep,
+            call_names[k], (unsigned long long)calls[k].count, calls[k].time,
+            (unsigned long long)calls[k].bytes);
+    sep = ",";
+  }
+  fprintf(out, "},\"sent_bytes\":[");
+  for (int k = 0; k < world_size; k++) {
+    fprintf(out, "%s%llu", k ? "," : "", (unsigned long long)sent_bytes[k]);
+  }
+  fprintf(out, "],\"sent_msgs\":[");
+  for (int k = 0; k < world_size; k++) {
+    fprintf(out, "%s%llu", k ? "," : "", (unsigned long long)sent_msgs[k]);
+  }
+  fprintf(out, "]}\n");
+  fclose(out);
+}
+
+int MPI_Finalize(void) {
+  if (sent_bytes != NULL) {
+    ck_profile_dump(PMPI_Wtime() - init_time);
+    PMPI_Group_free(&world_group);
+    free(sent_bytes);
+    free(sent_msgs);
+    sent_bytes = sent_msgs = NULL;
+  }
+  return PMPI_Finalize();
+}
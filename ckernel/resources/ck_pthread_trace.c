@@ -0,0 +1,356 @@
+/**
+ * A preload library which traces lock contention and thread activity.
+ *
+ * Wraps pthread_create, pthread_mutex_lock/unlock, pthread_cond_wait and
+ * pthread_barrier_wait. Per-lock statistics are accumulated in a fixed table
+ * and each blocking interval is recorded in a ring buffer (so only the most
+ * recent CK_TRACE_EVENTS intervals are kept). Threads after the first
+ * CK_MAX_THREADS aren't traced, only counted. At exit, everything is written
+ * as a Chrome trace to the file named by the CK_PTHREAD_TRACE environment
+ * variable.
+ *
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h> // for dlsym
+#include <inttypes.h>
+#if defined(__ELF__)
+#include <link.h> // for ElfW
+#endif
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CK_TRACE_EVENTS (1 << 16)
+#define CK_MAX_LOCKS 1024
+#define CK_MAX_THREADS 1024
+#define CK_UNTRACED_THREAD UINT16_MAX
+
+#define CKERROR(fmt, ...)                                                      \
+  fprintf(stderr, "[ck_pthread_trace] " fmt "\n", __VA_ARGS__)
+
+enum event_kind { EV_MUTEX, EV_COND, EV_BARRIER };
+
+static const char *event_names[] = {"mutex wait", "cond wait", "barrier wait"};
+
+// one blocking interval of one thread
+struct event {
+  uint64_t start;
+  uint64_t duration;
+  const void *object;
+  uint16_t thread;
+  uint8_t kind;
+};
+
+struct lock_stats {
+  _Atomic(const void *) lock;
+  atomic_uint_fast64_t acquired;
+  atomic_uint_fast64_t contended;
+  atomic_uint_fast64_t wait_ns;
+  atomic_uint_fast64_t max_wait_ns;
+  atomic_uint_fast64_t hold_ns;
+  uint64_t acquired_at; // only written while the lock is held
+};
+
+struct thread_info {
+  uint64_t start;
+  uint64_t end;
+};
+
+// pointers to the real pthread functions
+struct pthread_fp {
+  int (*create)(pthread_t *, const pthread_attr_t *, void *(*)(void *),
+                void *);
+  int (*mutex_lock)(pthread_mutex_t *);
+  int (*mutex_trylock)(pthread_mutex_t *);
+  int (*mutex_unlock)(pthread_mutex_t *);
+  int (*cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+  int (*barrier_wait)(pthread_barrier_t *);
+};
+
+static struct pthread_fp pfp = {0};
+static struct event events[CK_TRACE_EVENTS];
+static atomic_uint_fast64_t next_event = 0;
+static struct lock_stats locks[CK_MAX_LOCKS];
+static struct thread_info threads[CK_MAX_THREADS];
+static atomic_uint next_thread = 1; // thread 0 is the main thread
+static atomic_uint untraced_threads = 0;
+static _Thread_local uint16_t this_thread = 0;
+static uint64_t epoch = 0;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void *next_symbol(const char *name, const char *version) {
+  void *sym = NULL;
+#if defined(__GLIBC__)
+  // the unversioned symbol may be an old ABI (e.g. pthread_cond_wait)
+  if (version != NULL) {
+    sym = dlvsym(RTLD_NEXT, name, version);
+  }
+#else
+  (void)version;
+#endif
+  if (sym == NULL) {
+    sym = dlsym(RTLD_NEXT, name);
+  }
+  if (sym == NULL) {
+    CKERROR("failed to find symbol %s", name);
+  }
+  return sym;
+}
+
+static void ck_trace_setup(void) {
+  if (pfp.mutex_lock != NULL) {
+    return;
+  }
+  pfp.create = next_symbol("pthread_create", NULL);
+  pfp.mutex_trylock = next_symbol("pthread_mutex_trylock", NULL);
+  pfp.mutex_unlock = next_symbol("pthread_mutex_unlock", NULL);
+  pfp.cond_wait = next_symbol("pthread_cond_wait", "GLIBC_2.3.2");
+  pfp.barrier_wait = next_symbol("pthread_barrier_wait", NULL);
+  pfp.mutex_lock = next_symbol("pthread_mutex_lock", NULL);
+}
+
+static void __attribute__((constructor)) ck_trace_init(void) {
+  ck_trace_setup();
+  epoch = now_ns();
+  threads[0].start = epoch;
+}
+
+static void record_event(enum event_kind kind, const void *object,
+                         uint64_t start, uint64_t end) {
+  if (this_thread == CK_UNTRACED_THREAD) {
+    return;
+  }
+  uint64_t slot = atomic_fetch_add(&next_event, 1) % CK_TRACE_EVENTS;
+  events[slot] = (struct event){start, end - start, object, this_thread,
+                                (uint8_t)kind};
+}
+
+// find (or claim) the statistics entry for a lock, or NULL if the table is full
+static struct lock_stats *find_lock(const void *lock) {
+  size_t first = ((uintptr_t)lock >> 4) % CK_MAX_LOCKS;
+  for (size_t k = 0; k < CK_MAX_LOCKS; k++) {
+    struct lock_stats *entry = &locks[(first + k) % CK_MAX_LOCKS];
+    const void *current = atomic_load(&entry->lock);
+    if (current == lock) {
+      return entry;
+    }
+    if (current == NULL) {
+      const void *expected = NULL;
+      if (atomic_compare_exchange_strong(&entry->lock, &expected, lock) ||
+          expected == lock) {
+        return entry;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void update_max(atomic_uint_fast64_t *max, uint64_t value) {
+  uint64_t current = atomic_load(max);
+  while (value > current && !atomic_compare_exchange_weak(max, &current, value))
+    ;
+}
+
+struct start_args {
+  void *(*start_routine)(void *);
+  void *arg;
+  uint16_t thread;
+};
+
+static void *ck_thread_start(void *arg) {
+  struct start_args start = *(struct start_args *)arg;
+  free(arg);
+  this_thread = start.thread;
+  if (this_thread == CK_UNTRACED_THREAD) {
+    return start.start_routine(start.arg);
+  }
+  threads[this_thread].start = now_ns();
+  void *result = start.start_routine(start.arg);
+  threads[this_thread].end = now_ns();
+  return result;
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg) {
+  ck_trace_setup();
+  struct start_args *start = malloc(sizeof(*start));
+  if (start == NULL) {
+    return pfp.create(thread, attr, start_routine, arg);
+  }
+  // a thread beyond the table is marked so its waits aren't given to another
+  unsigned id = atomic_fetch_add(&next_thread, 1);
+  if (id >= CK_MAX_THREADS) {
+    atomic_fetch_add(&untraced_threads, 1);
+    id = CK_UNTRACED_THREAD;
+  }
+  *start = (struct start_args){start_routine, arg, (uint16_t)id};
+  return pfp.create(thread, attr, ck_thread_start, start);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  ck_trace_setup();
+  struct lock_stats *stats = find_lock(mutex);
+  int result = pfp.mutex_trylock(mutex);
+  bool contended = (result != 0);
+  uint64_t start = 0, end = 0;
+  if (contended) {
+    start = now_ns();
+    result = pfp.mutex_lock(mutex);
+    end = now_ns();
+    record_event(EV_MUTEX, mutex, start, end);
+  }
+  if (result == 0 && stats != NULL) {
+    atomic_fetch_add(&stats->acquired, 1);
+    if (contended) {
+      atomic_fetch_add(&stats->contended, 1);
+      atomic_fetch_add(&stats->wait_ns, end - start);
+      update_max(&stats->max_wait_ns, end - start);
+    }
+    stats->acquired_at = contended ? end : now_ns();
+  }
+  return result;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  ck_trace_setup();
+  struct lock_stats *stats = find_lock(mutex);
+  if (stats != NULL && stats->acquired_at != 0) {
+    atomic_fetch_add(&stats->hold_ns, now_ns() - stats->acquired_at);
+    stats->acquired_at = 0;
+  }
+  return pfp.mutex_unlock(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  ck_trace_setup();
+  struct lock_stats *stats = find_lock(mutex);
+  uint64_t start = now_ns();
+  // the mutex is released while waiting, so stop counting its hold time
+  if (stats != NULL && stats->acquired_at != 0) {
+    atomic_fetch_add(&stats->hold_ns, start - stats->acquired_at);
+  }
+  int result = pfp.cond_wait(cond, mutex);
+  uint64_t end = now_ns();
+  if (stats != NULL) {
+    stats->acquired_at = end;
+  }
+  record_event(EV_COND, cond, start, end);
+  return result;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier) {
+  ck_trace_setup();
+  uint64_t start = now_ns();
+  int result = pfp.barrier_wait(barrier);
+  record_event(EV_BARRIER, barrier, start, now_ns());
+  return result;
+}
+
+static double to_us(uint64_t ns) { return (double)ns / 1000.0; }
+
+// Return the address of an object as the kernel's nm sees it in the file which
+// contains it, naming the file. Only position-independent (ET_DYN) files are
+// loaded away from the addresses in their symbol table.
+static uintptr_t file_address(const void *addr, const char **file) {
+  Dl_info info = {0};
+  *file = "";
+  if (dladdr(addr, &info) == 0 || info.dli_fbase == NULL) {
+    return (uintptr_t)addr;
+  }
+  *file = info.dli_fname ? info.dli_fname : "";
+#if defined(__ELF__)
+  const ElfW(Ehdr) *header = info.dli_fbase;
+  if (header->e_type != ET_DYN) {
+    return (uintptr_t)addr;
+  }
+#endif
+  return (uintptr_t)addr - (uintptr_t)info.dli_fbase;
+}
+
+static void write_json_string(FILE *out, const char *text) {
+  fputc('"', out);
+  for (; *text != '\0'; text++) {
+    if (*text == '"' || *text == '\\') {
+      fputc('\\', out);
+    }
+    fputc(*text, out);
+  }
+  fputc('"', out);
+}
+
+static void __attribute__((destructor)) ck_trace_dump(void) {
+  const char *path = getenv("CK_PTHREAD_TRACE");
+  if (path == NULL) {
+    return;
+  }
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    CKERROR("failed to open %s", path);
+    return;
+  }
+  uint64_t end = now_ns();
+  unsigned nthreads = atomic_load(&next_thread);
+  nthreads = nthreads < CK_MAX_THREADS ? nthreads : CK_MAX_THREADS;
+  uint64_t total = atomic_load(&next_event);
+  uint64_t first = total > CK_TRACE_EVENTS ? total - CK_TRACE_EVENTS : 0;
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  const char *sep = "";
+  for (unsigned t = 0; t < nthreads; t++) {
+    if (threads[t].start == 0) {
+      continue;
+    }
+    uint64_t stop = threads[t].end ? threads[t].end : end;
+    fprintf(out,
+            "%s{\"name\":\"running\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f}",
+            sep, t, to_us(threads[t].start - epoch),
+            to_us(stop - threads[t].start));
+    sep = ",\n";
+  }
+  for (uint64_t k = first; k < total; k++) {
+    struct event *ev = &events[k % CK_TRACE_EVENTS];
+    fprintf(out,
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"object\":\"%p\"}}",
+            sep, event_names[ev->kind], ev->thread, to_us(ev->start - epoch),
+            to_us(ev->duration), ev->object);
+    sep = ",\n";
+  }
+  fprintf(out,
+          "\n],\"ckDroppedEvents\":%" PRIu64 ",\"ckUntracedThreads\":%u"
+          ",\"ckLocks\":[\n",
+          first, atomic_load(&untraced_threads));
+  sep = "";
+  for (size_t k = 0; k < CK_MAX_LOCKS; k++) {
+    const void *lock = atomic_load(&locks[k].lock);
+    if (lock == NULL || atomic_load(&locks[k].acquired) == 0) {
+      continue;
+    }
+    // locate the lock within its file so the kernel can name it
+    const char *file;
+    uintptr_t offset = file_address(lock, &file);
+    fprintf(out, "%s{\"file\":", sep);
+    write_json_string(out, file);
+    fprintf(out,
+            ",\"lock\":\"%p\",\"offset\":%" PRIuPTR ",\"acquired\":%" PRIu64
+            ",\"contended\":%" PRIu64
+            ",\"wait_us\":%.3f,\"max_wait_us\":%.3f,\"hold_us\":%.3f}",
+            lock, offset, (uint64_t)atomic_load(&locks[k].acquired),
+            (uint64_t)atomic_load(&locks[k].contended),
+            to_us(atomic_load(&locks[k].wait_ns)),
+            to_us(atomic_load(&locks[k].max_wait_ns)),
+            to_us(atomic_load(&locks[k].hold_ns)));
+    sep = ",\n";
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+}
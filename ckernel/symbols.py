@@ -0,0 +1,94 @@
+"""An index of the symbols defined and used by the objects built in a session,
+to find the objects a program must be linked with"""
+from __future__ import annotations
+
+from typing import Dict, Iterable, List, NamedTuple, Set, Tuple
+
+# nm's types of symbols which may be defined more than once: weak symbols and
+# common (tentative) definitions
+_weak = set("VWC")
+
+# The entry point, whose object is a program rather than a library
+_main = {"main", "_main"}
+
+
+class ObjectSymbols(NamedTuple):
+    defined: Set[str]  # global symbols which the object defines
+    strong: Set[str]  # those of defined which can't be defined elsewhere
+    undefined: Set[str]  # symbols which the object uses but doesn't define
+
+
+def parse_nm(lines: Iterable[str]) -> ObjectSymbols:
+    "Parse the output of nm -P for one object"
+    defined, strong, undefined = set(), set(), set()
+    for line in lines:
+        fields = line.split()
+        if len(fields) < 2:
+            continue
+        name, kind = fields[0], fields[1]
+        if kind == "U":
+            undefined.add(name)
+        elif kind.isupper():
+            defined.add(name)
+            if kind not in _weak:
+                strong.add(name)
+    return ObjectSymbols(defined, strong, undefined)
+
+
+class SymbolIndex:
+    "The symbols of each object built in the session, by object name"
+
+    def __init__(self):
+        self.objects: Dict[str, ObjectSymbols] = {}
+
+    def add(self, obj: str, symbols: ObjectSymbols):
+        self.objects[obj] = symbols
+
+    def definitions(self, name: str, exclude: Iterable[str] = ()) -> List[str]:
+        "Return the objects which define a symbol, apart from those excluded"
+        exclude = set(exclude)
+        return [
+            obj
+            for obj, symbols in self.objects.items()
+            if obj not in exclude
+            and name in symbols.defined
+            and not symbols.defined & _main
+        ]
+
+    def resolve(
+        self, linked: Dict[str, ObjectSymbols]
+    ) -> Tuple[List[str], Dict[str, List[str]]]:
+        """Return the objects to add to a link of the given objects so that the
+        symbols they use are defined, following the symbols which those use
+        in turn. Also return the symbols which more than one object could
+        define, which are left to the user. Symbols which no object in the
+        index defines are left to the linker, e.g. those from libraries."""
+        linked = dict(linked)
+        added: List[str] = []
+        ambiguous: Dict[str, List[str]] = {}
+        pending = list(linked)
+        while pending:
+            for name in sorted(linked[pending.pop(0)].undefined):
+                if any(name in symbols.defined for symbols in linked.values()):
+                    continue
+                candidates = self.definitions(name, linked)
+                if len(candidates) > 1:
+                    ambiguous[name] = candidates
+                elif candidates:
+                    linked[candidates[0]] = self.objects[candidates[0]]
+                    added.append(candidates[0])
+                    pending.append(candidates[0])
+        # an object added for one symbol may have defined an ambiguous one
+        for name in list(ambiguous):
+            if any(name in symbols.defined for symbols in linked.values()):
+                del ambiguous[name]
+        return added, ambiguous
+
+
+def duplicates(linked: Dict[str, ObjectSymbols]) -> Dict[str, List[str]]:
+    "Return the symbols which more than one of the objects define strongly"
+    found: Dict[str, List[str]] = {}
+    for obj, symbols in linked.items():
+        for name in symbols.strong:
+            found.setdefault(name, []).append(obj)
+    return {name: objs for name, objs in found.items() if len(objs) > 1}
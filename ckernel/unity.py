@@ -0,0 +1,132 @@
+"""Unity builds, which compile the sources of several cells as one translation
+unit"""
+from __future__ import annotations
+
+import re
+from pathlib import Path
+from typing import Dict, List, NamedTuple
+
+# A declaration with internal linkage at file scope, which by convention starts
+# in the first column, e.g. "static int count = 0;" or "static inline void f("
+_static = re.compile(r"^static\b([^;{(=\[,]*)", re.MULTILINE)
+_define = re.compile(r"^\s*#\s*define\s+(\w+)", re.MULTILINE)
+_identifier = re.compile(r"[A-Za-z_]\w*")
+# The declarator after the body of "static struct tag { ... } name;"
+_declarator = re.compile(r"[^;{(=\[,]*")
+# The tokens of a source which may contain an identifier that isn't one
+_token = re.compile(
+    r"^[ \t]*#[ \t]*include\b[^\n]*"
+    r"""|//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\\n])*"|'(?:\\.|[^'\\\n])*'"""
+    r"|[A-Za-z_]\w*",
+    re.DOTALL | re.MULTILINE,
+)
+_tags = {"enum", "struct", "union"}
+_keywords = {
+    "auto",
+    "char",
+    "const",
+    "constexpr",
+    "double",
+    "enum",
+    "float",
+    "inline",
+    "int",
+    "long",
+    "short",
+    "signed",
+    "struct",
+    "thread_local",
+    "union",
+    "unsigned",
+    "void",
+    "volatile",
+    "_Thread_local",
+}
+
+
+class Cell(NamedTuple):
+    filename: str
+    source: str
+
+
+def statics(source: str) -> List[str]:
+    "Return the names declared static at file scope in a cell's source"
+    names = []
+    for match in _static.finditer(source):
+        declaration = match.group(1)
+        if source[match.end() : match.end() + 1] == "{" and _tags & set(
+            _identifier.findall(declaration)
+        ):
+            # the name follows the body of the struct, union or enum
+            end = closing_brace(source, match.end())
+            declaration = _declarator.match(source, end).group(0)
+        words = [
+            word for word in _identifier.findall(declaration) if word not in _keywords
+        ]
+        if words and words[-1] not in names:
+            names.append(words[-1])
+    return names
+
+
+def closing_brace(source: str, start: int) -> int:
+    "Return the index after the brace which closes the one at start"
+    depth = 0
+    for index in range(start, len(source)):
+        if source[index] == "{":
+            depth += 1
+        elif source[index] == "}":
+            depth -= 1
+            if depth == 0:
+                return index + 1
+    return len(source)
+
+
+def macros(source: str) -> List[str]:
+    "Return the macros defined in a cell's source"
+    return list(dict.fromkeys(_define.findall(source)))
+
+
+def clashes(cells: List[Cell]) -> Dict[str, List[str]]:
+    """Return, for each cell, its static names which any other cell also uses.
+    These would collide once the cells share a translation unit."""
+    found = {}
+    for cell in cells:
+        others = "\n".join(other.source for other in cells if other is not cell)
+        found[cell.filename] = [
+            name
+            for name in statics(cell.source)
+            if re.search(rf"\b{re.escape(name)}\b", others)
+        ]
+    return found
+
+
+def prefix(filename: str) -> str:
+    "Return the prefix given to the renamed statics of a cell"
+    return "ck_unity_" + re.sub(r"\W", "_", Path(filename).name) + "_"
+
+
+def rename(source: str, names: Dict[str, str]) -> str:
+    """Return the source with the identifiers in names renamed. Comments and
+    string and character literals are left as they are, as are the headers the
+    source includes."""
+
+    def replace(match: re.Match) -> str:
+        return names.get(match.group(0), match.group(0))
+
+    return _token.sub(replace, source)
+
+
+def generate(cells: List[Cell]) -> str:
+    """Return a source concatenating the cells, in order. Each cell's clashing
+    statics are renamed and the macros it defines are undefined after it, so
+    that each cell sees only its own names as it would if it were compiled
+    alone. Line directives keep diagnostics pointing at the cells."""
+    renamed = clashes(cells)
+    lines = [f"/* unity build of {', '.join(cell.filename for cell in cells)} */"]
+    for cell in cells:
+        names = {name: prefix(cell.filename) + name for name in renamed[cell.filename]}
+        lines.append("")
+        lines.append(f'#line 1 "{cell.filename}"')
+        lines.append(rename(cell.source, names).rstrip("\n"))
+        lines += [f"#undef {name}" for name in macros(cell.source)]
+    return "\n".join(lines) + "\n"
@@ -1,18 +1,34 @@
 """ckernel utilities"""
 from __future__ import annotations
 
+import ctypes.util
+import glob
 import os
 import platform
+import re
+import shutil
+import statistics
 import traceback
 from contextlib import contextmanager
 from enum import Enum
 from pathlib import Path
 from tempfile import mkdtemp
-from typing import NamedTuple, Optional
+from typing import Iterable, NamedTuple, Optional
 
 
 is_macOS: bool = platform.system() == "Darwin"
 
+# The environment variable used to preload shared libraries into an executable
+preload_variable = "DYLD_INSERT_LIBRARIES" if is_macOS else "LD_PRELOAD"
+
+# The library names under which each known allocator may be installed
+allocator_libraries: dict[str, list[str]] = {
+    "glibc": [],
+    "jemalloc": ["jemalloc"],
+    "mimalloc": ["mimalloc"],
+    "tcmalloc": ["tcmalloc", "tcmalloc_minimal"],
+}
+
 
 def temporary_directory(prefix: Optional[str] = None):
     "Return a temporary directory"
@@ -27,6 +43,11 @@ class EnvironmentVariables(NamedTuple):
     CKERNEL_EXE_CXXFLAGS: Optional[str]
     CKERNEL_EXE_LDFLAGS: Optional[str]
     CKERNEL_EAT_NEWLINE: Optional[str]
+    CKERNEL_MPICC: Optional[str]
+    CKERNEL_MPICXX: Optional[str]
+    CKERNEL_MPIRUN: Optional[str]
+    CKERNEL_PROFILES: Optional[str]
+    CKERNEL_PROFILE: Optional[str]
 
 
 def get_environment_variables(default: Optional[str] = None) -> EnvironmentVariables:
@@ -35,6 +56,132 @@ def get_environment_variables(default: Optional[str] = None) -> EnvironmentVaria
     )
 
 
+def find_library(names: Iterable[str]) -> Optional[str]:
+    "Return the first of the named shared libraries found locally, if any"
+    for name in names:
+        found = ctypes.util.find_library(name)
+        if found is not None:
+            return found
+    return None
+
+
+def find_program(name: str) -> Optional[str]:
+    """Return the path of the named program, falling back to versioned names
+    (e.g. llvm-mca-18) and LLVM's versioned install directories, preferring
+    the newest version, if it isn't on the PATH"""
+    found = shutil.which(name)
+    if found is not None:
+        return found
+    candidates = []
+    for directory in os.environ.get("PATH", "").split(os.pathsep):
+        candidates.extend(glob.glob(os.path.join(directory, f"{name}-[0-9]*")))
+    for pattern in ("/usr/lib/llvm-*/bin", "/opt/homebrew/opt/llvm/bin"):
+        candidates.extend(glob.glob(os.path.join(pattern, name)))
+    return max(
+        candidates,
+        key=lambda path: [int(n) for n in re.findall(r"\d+", path)],
+        default=None,
+    )
+
+
+def transparent_hugepage_mode() -> Optional[str]:
+    "Return the system's transparent huge page mode, or None if unavailable"
+    try:
+        with open(
+            "/sys/kernel/mm/transparent_hugepage/enabled", encoding="utf-8"
+        ) as thp:
+            current = thp.read()
+    except OSError:
+        return None
+    _, _, rest = current.partition("[")
+    mode, _, _ = rest.partition("]")
+    return mode or None
+
+
+class ISALevel(NamedTuple):
+    "An instruction-set level and the CPU features it requires"
+    name: str
+    flag: str
+    features: frozenset
+
+
+# Levels are listed from the baseline up. Feature names are as they appear in
+# /proc/cpuinfo (sse3 is "pni" and lzcnt is "abm" there)
+ISA_LEVELS = {
+    "x86_64": [
+        ISALevel("x86-64-v1", "-march=x86-64", frozenset({"sse2"})),
+        ISALevel(
+            "x86-64-v2",
+            "-march=x86-64-v2",
+            frozenset({"cx16", "popcnt", "pni", "ssse3", "sse4_1", "sse4_2"}),
+        ),
+        ISALevel(
+            "x86-64-v3",
+            "-march=x86-64-v3",
+            frozenset({"avx", "avx2", "bmi1", "bmi2", "f16c", "fma", "abm", "movbe"}),
+        ),
+        ISALevel(
+            "x86-64-v4",
+            "-march=x86-64-v4",
+            frozenset({"avx512f", "avx512bw", "avx512cd", "avx512dq", "avx512vl"}),
+        ),
+    ],
+    "aarch64": [
+        ISALevel("armv8-a", "-march=armv8-a", frozenset({"asimd"})),
+        ISALevel("armv8.2-a+sve", "-march=armv8.2-a+sve", frozenset({"sve"})),
+        ISALevel("armv9-a", "-march=armv9-a", frozenset({"sve2"})),
+    ],
+}
+
+
+def cpu_features() -> set[str]:
+    "Return the host CPU's feature flags as listed in /proc/cpuinfo"
+    features: set[str] = set()
+    try:
+        with open("/proc/cpuinfo", encoding="utf-8") as cpuinfo:
+            for line in cpuinfo:
+                key, _, value = line.partition(":")
+                if key.strip() in ("flags", "Features"):
+                    features.update(value.split())
+    except OSError:
+        pass
+    return features
+
+
+def isa_levels() -> list[tuple[ISALevel, bool]]:
+    """Return the instruction-set levels of the host architecture, each with
+    whether the host CPU supports it. Each level requires the features of the
+    levels before it."""
+    machine = platform.machine().lower()
+    machine = {"amd64": "x86_64", "arm64": "aarch64"}.get(machine, machine)
+    levels = ISA_LEVELS.get(machine, [])
+    features = cpu_features()
+    result = []
+    supported = True
+    for level in levels:
+        supported = supported and level.features <= features
+        result.append((level, supported))
+    return result
+
+
+def timing_summary(times: list[float]) -> str:
+    "Summarise a list of run times in seconds"
+    summary = (
+        f"{len(times)} runs: min {min(times):.6f} s, "
+        f"median {statistics.median(times):.6f} s, "
+        f"mean {statistics.mean(times):.6f} s"
+    )
+    if len(times) > 1:
+        summary += f" (stdev {statistics.stdev(times):.6f} s)"
+    return summary
+
+
+def remove_file(path: str):
+    "Remove a file if it exists"
+    if os.path.isfile(path):
+        os.unlink(path)
+
+
 @contextmanager
 def switch_directory(new: str):
     old = os.getcwd()